@@ -0,0 +1,252 @@
+// NUMA topology from the ACPI tables.
+// See the ACPI Specification, 5.2 (RSDP, RSDT), 5.2.16 (SRAT)
+// and 5.2.17 (SLIT).
+//
+// The System Resource Affinity Table puts each CPU and each
+// range of memory in a proximity domain; the System Locality
+// Information Table gives the relative distance between domains,
+// 10 meaning local. Domains are numbered 0..nnode-1 here in the
+// order memory appears in the SRAT, so that the one holding low
+// memory, where the kernel is, is node 0. Without an SRAT there
+// is a single node.
+//
+// kalloc.c keeps a pool of free pages per node and allocates
+// from the pool of the running CPU's node, falling back to the
+// nearest others.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+
+int nnode = 1;
+static uchar dist[NNODE][NNODE];
+
+struct rsdp {
+  uchar signature[8];           // "RSD PTR "
+  uchar checksum;               // of the first 20 bytes
+  uchar oemid[6];
+  uchar revision;
+  uint rsdt;                    // physical address of the RSDT
+};
+
+struct sdthdr {                 // header of every table
+  uchar signature[4];
+  uint length;                  // of the table, header included
+  uchar revision;
+  uchar checksum;               // all bytes must add up to 0
+  uchar oemid[6];
+  uchar oemtable[8];
+  uint oemrev;
+  uint creator;
+  uint creatorrev;
+};
+
+struct srat {
+  struct sdthdr h;              // "SRAT"
+  uint reserved[3];
+};
+
+struct sratcpu {                // processor local APIC affinity
+  uchar type;                   // 0
+  uchar length;                 // 16
+  uchar domainlo;               // bits 0-7 of the domain
+  uchar apicid;
+  uint flags;
+  uchar sapiceid;
+  uchar domainhi[3];            // bits 8-31
+  uint clock;
+};
+
+struct sratmem {                // memory affinity
+  uchar type;                   // 1
+  uchar length;                 // 40
+  uint domain;
+  ushort reserved1;
+  uint base, basehi;
+  uint len, lenhi;
+  uint reserved2;
+  uint flags;
+  uint reserved3[2];
+};
+
+#define SRATCPU  0
+#define SRATMEM  1
+#define ENABLED  0x1            // in the flags of an SRAT entry
+
+struct slit {
+  struct sdthdr h;              // "SLIT"
+  uint n, nhi;                  // number of domains
+  uchar dist[];                 // n*n distances, row by row
+};
+
+static uint domains[NNODE];     // proximity domain of each node
+
+static uchar
+sum(uchar *addr, int len)
+{
+  int i, sum;
+
+  sum = 0;
+  for(i=0; i<len; i++)
+    sum += addr[i];
+  return sum;
+}
+
+// Look for the RSDP in the len bytes at physical address a.
+static struct rsdp*
+rsdpsearch1(uint a, int len)
+{
+  uchar *e, *p, *addr;
+
+  addr = P2V(a);
+  e = addr+len;
+  for(p = addr; p < e; p += 16)
+    if(memcmp(p, "RSD PTR ", 8) == 0 && sum(p, 20) == 0)
+      return (struct rsdp*)p;
+  return 0;
+}
+
+// The RSDP is on a 16-byte boundary in the first KB of the
+// EBDA, or in the BIOS ROM between 0xE0000 and 0xFFFFF.
+static struct rsdp*
+rsdpsearch(void)
+{
+  uchar *bda;
+  uint p;
+  struct rsdp *rsdp;
+
+  bda = (uchar *) P2V(0x400);
+  if((p = ((bda[0x0F]<<8)| bda[0x0E]) << 4))
+    if((rsdp = rsdpsearch1(p, 1024)))
+      return rsdp;
+  return rsdpsearch1(0xE0000, 0x20000);
+}
+
+// Map the table at physical address pa and check it.
+// Returns 0 if it cannot be used.
+static struct sdthdr*
+sdtmap(uint pa)
+{
+  struct sdthdr *h;
+
+  if((h = kmapfirmware(pa, sizeof(*h))) == 0)
+    return 0;
+  if(h->length < sizeof(*h) || kmapfirmware(pa, h->length) == 0 ||
+     sum((uchar*)h, h->length) != 0)
+    return 0;
+  return h;
+}
+
+// Find the table with signature sig through the RSDT.
+static struct sdthdr*
+sdtfind(struct sdthdr *rsdt, char *sig)
+{
+  uint *p, *e;
+  struct sdthdr *h;
+
+  p = (uint*)(rsdt + 1);
+  e = (uint*)((uchar*)rsdt + rsdt->length);
+  for(; p < e; p++)
+    if((h = sdtmap(*p)) != 0 && memcmp(h->signature, sig, 4) == 0)
+      return h;
+  return 0;
+}
+
+// Node of proximity domain d, allocating one for a domain
+// not seen yet. Domains past NNODE share node 0.
+static int
+domainnode(uint d)
+{
+  int n;
+
+  for(n = 0; n < nnode; n++)
+    if(domains[n] == d)
+      return n;
+  if(nnode == NNODE)
+    return 0;
+  domains[nnode] = d;
+  return nnode++;
+}
+
+static void
+sratparse(struct srat *srat)
+{
+  uchar *p, *e;
+  struct sratcpu *c;
+  struct sratmem *m;
+  uint end;
+  int i;
+
+  // Memory first, so that it decides the node numbers.
+  nnode = 0;
+  e = (uchar*)srat + srat->h.length;
+  for(p = (uchar*)(srat + 1); p + 2 <= e && p[1] >= 2; p += p[1]){
+    m = (struct sratmem*)p;
+    if(m->type != SRATMEM || !(m->flags & ENABLED) || m->basehi)
+      continue;
+    end = m->lenhi || m->base + m->len < m->base ? 0 : m->base + m->len;
+    knodemem(m->base, end ? end : 0xFFFFFFFF, domainnode(m->domain));
+  }
+  if(nnode == 0)
+    nnode = 1;
+  for(p = (uchar*)(srat + 1); p + 2 <= e && p[1] >= 2; p += p[1]){
+    c = (struct sratcpu*)p;
+    if(c->type != SRATCPU || !(c->flags & ENABLED))
+      continue;
+    for(i = 0; i < ncpu; i++)
+      if(cpus[i].apicid == c->apicid)
+        cpus[i].node = domainnode(c->domainlo | c->domainhi[0] << 8 |
+                                  c->domainhi[1] << 16 |
+                                  c->domainhi[2] << 24);
+  }
+}
+
+static void
+slitparse(struct slit *slit)
+{
+  int i, j;
+
+  if(slit->nhi || slit->h.length < sizeof(*slit) + slit->n * slit->n)
+    return;
+  for(i = 0; i < nnode; i++)
+    for(j = 0; j < nnode; j++)
+      if(domains[i] < slit->n && domains[j] < slit->n)
+        dist[i][j] = slit->dist[domains[i] * slit->n + domains[j]];
+}
+
+// Find the NUMA nodes of the CPUs and of memory. Called
+// after mpinit() has found the CPUs, and before kinit2()
+// frees most of memory.
+void
+acpiinit(void)
+{
+  struct rsdp *rsdp;
+  struct sdthdr *rsdt, *h;
+  int i, j;
+
+  if((rsdp = rsdpsearch()) != 0 && (rsdt = sdtmap(rsdp->rsdt)) != 0 &&
+     memcmp(rsdt->signature, "RSDT", 4) == 0){
+    if((h = sdtfind(rsdt, "SRAT")) != 0)
+      sratparse((struct srat*)h);
+    for(i = 0; i < nnode; i++)
+      for(j = 0; j < nnode; j++)
+        dist[i][j] = i == j ? 10 : 20;
+    if((h = sdtfind(rsdt, "SLIT")) != 0)
+      slitparse((struct slit*)h);
+  }
+  for(i = 0; i < nnode; i++)
+    dist[i][i] = 10;
+  if(nnode > 1)
+    cprintf("acpi: %d numa nodes\n", nnode);
+}
+
+// Relative distance from node a to node b, 10 if they are
+// the same.
+int
+nodedist(int a, int b)
+{
+  return dist[a][b];
+}
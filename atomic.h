@@ -0,0 +1,70 @@
+// Atomic operations for threads sharing memory (see thread.h)
+// Everything with a lock prefix is also a full memory barrier.
+// Include after types.h.
+
+// compiler barrier, x86 keeps loads and stores in program order
+// except that a load may pass an older store to another address
+#define atomic_barrier() asm volatile("" ::: "memory")
+
+// full barrier, also orders stores before later loads
+static inline void
+atomic_fence(void)
+{
+    asm volatile("lock; addl $0, 0(%%esp)" ::: "memory", "cc");
+}
+
+// hint for spin-wait loops
+static inline void
+atomic_pause(void)
+{
+    asm volatile("pause" ::: "memory");
+}
+
+// *addr = new if *addr == old, returns 1 if it was swapped
+static inline int
+atomic_cas(volatile uint *addr, uint old, uint new)
+{
+    uint prev;
+
+    asm volatile("lock; cmpxchgl %2, %1" :
+                 "=a" (prev), "+m" (*addr) :
+                 "r" (new), "0" (old) :
+                 "memory", "cc");
+    return prev == old;
+}
+
+// 64-bit compare and swap, used for pointer + tag pairs
+static inline int
+atomic_cas64(volatile unsigned long long *addr,
+             unsigned long long old, unsigned long long new)
+{
+    unsigned long long prev;
+
+    asm volatile("lock; cmpxchg8b %1" :
+                 "=A" (prev), "+m" (*addr) :
+                 "b" ((uint)new), "c" ((uint)(new >> 32)), "0" (old) :
+                 "memory", "cc");
+    return prev == old;
+}
+
+// *addr += v, returns the old value
+static inline uint
+atomic_fetch_add(volatile uint *addr, uint v)
+{
+    asm volatile("lock; xaddl %0, %1" :
+                 "+r" (v), "+m" (*addr) :
+                 :
+                 "memory", "cc");
+    return v;
+}
+
+// *addr = v, returns the old value
+static inline uint
+atomic_xchg(volatile uint *addr, uint v)
+{
+    asm volatile("lock; xchgl %0, %1" :
+                 "+r" (v), "+m" (*addr) :
+                 :
+                 "memory");
+    return v;
+}
@@ -1,15 +1,24 @@
 struct buf;
 struct context;
 struct file;
+struct fxsave;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
+struct procmem;
 struct rtcdate;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
 
+// acpi.c
+void            acpiinit(void);
+int             nodedist(int, int);
+extern int      nnode;
+
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
@@ -24,6 +33,7 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -53,6 +63,12 @@ int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// fpu.c
+void            fpuinit(void);
+void            fputrap(void);
+void            fpusave(struct proc*);
+void            fpuload(struct proc*, struct fxsave*);
+
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
@@ -68,6 +84,22 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+int             kpages(void);
+int             knfree(int);
+int             knodepages(int);
+void            knodemem(uint, uint, int);
+char*           kallocpages(int);
+char*           kallocuser(void);
+char*           kallocuserpages(int);
+void            kfreepages(char*, int);
+void            ksplitpages(char*, int);
+void            kmemdump(void);
+extern uint     phystop;
+char*           kzalloc(void);
+char*           kzallocuser(void);
+void            kzeroidle(void);
+void            kref(char*);
+int             krefcount(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -78,6 +110,7 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(uchar, int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -95,7 +128,14 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pagecache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint, int*);
+void            pcacheinval(struct inode*);
+void            pcacheupdate(struct inode*, uint, char*, uint);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -106,12 +146,18 @@ int             pipewrite(struct pipe*, char*, int);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
-int             growproc(int);
+int             growproc(int, uint);
+void            growlock(struct proc*);
+void            growunlock(struct proc*);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
+int             pinned(pde_t*, uint);
 void            procdump(void);
+int             reclaim(int);
+int             spawn(char*, char**, int*, int);
+int             procmem(int, struct procmem*);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
@@ -132,6 +178,7 @@ int             set_priority(uint priority);
 int             change_policy(int new_policy);
 int             update_proc_timing(void);
 int             get_proc_timing(void *ret);
+int             thread_join_any(void);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -145,6 +192,37 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void*           kmalloc(uint);
+void            kmfree(void*);
+
+// snapshot.c
+int             snapshot(struct file*);
+int             restore(char*);
+
+// shm.c
+void            shminit(void);
+struct shm*     shmget(char*, uint);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+uint            shmsize(struct shm*);
+char*           shmpage(struct shm*, uint);
+
+// swap.c
+void            swapinit(int);
+int             swapqueue(char*);
+int             swapflush(void);
+int             swapdup(uint);
+void            swapfree(uint);
+void            swapread(uint, char*);
+void            swapcount(uint*, uint*);
+char*           kallocswap(int);
+char*           kzallocswap(int);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -162,7 +240,7 @@ char*           strncpy(char*, const char*, int);
 
 // syscall.c
 int             argint(int, int*);
-int             argptr(int, char**, int);
+int             argptr(int, char**, int, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -185,18 +263,35 @@ void            uartputc(int);
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
+void*           kmapfirmware(uint, uint);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+void            flushpages(pde_t*, uint, uint);
+void            hugeuvm(pde_t*, uint, uint);
+void            tlbpoll(void);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
-void            clearpteu(pde_t *pgdir, char *uva);
+int             pgfault(struct proc*, uint, uint);
+void            uvmstat(pde_t*, uint*, uint*, uint*);
+int             prefault(struct proc*, uint, uint, int);
+int             swapscan(pde_t*, uint*, int);
+void            vmadup(struct proc*, struct proc*);
+void            vmaput(struct proc*);
+void            vmasyncall(struct proc*);
+int             vmafree(struct proc*, uint, uint);
+uint            uend(struct proc*, uint);
+int             uvmused(pde_t*, uint);
+int             mmap(uint, uint, int, int, struct inode*, uint);
+int             munmap(uint, uint);
+int             msync(uint, uint);
+int             shmat(char*, uint);
+int             shmdt(uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -6,18 +6,32 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
 int
 exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// Replace the user memory of p with the program at path,
+// started with arguments argv. p is the current process, or
+// one that spawn() is creating and that has no memory yet.
+// Returns -1, leaving p as it was, if that cannot be done.
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nvma;
   uint argc, sz, sp, ustack[3+MAXARG+1];
+  struct vma vma[NVMA];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
 
   begin_op();
 
@@ -28,6 +42,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  nvma = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,7 +53,8 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program. Nothing is read yet: pgfault() brings
+  // in each page of a segment when it is first touched.
   sz = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -47,34 +63,59 @@ exec(char *path, char **argv)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
+    if(ph.vaddr + ph.memsz < ph.vaddr ||
+       ph.vaddr + ph.memsz > KERNBASE - MAXUSTACK)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < sz)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nvma == NVMA)
       goto bad;
+    vma[nvma].start = ph.vaddr;
+    vma[nvma].end = ph.vaddr + ph.memsz;
+    vma[nvma].off = ph.off;
+    vma[nvma].filesz = ph.filesz;
+    vma[nvma].writable = (ph.flags & ELF_PROG_FLAG_WRITE) != 0;
+    vma[nvma].shared = 0;
+    vma[nvma].ip = ip;
+    vma[nvma].shm = 0;
+    vma[nvma].stack = 0;
+    nvma++;
+    sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  iunlock(ip);
   end_op();
-  ip = 0;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
+  // The stack is a region at the top of user memory that
+  // pgfault() fills in as it grows down, up to MAXUSTACK. Its
+  // lowest page is never filled in, so that running off the
+  // end faults even if something is mapped just below. The
+  // top page is allocated now for the arguments.
   sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
-    goto bad;
-  clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
-  sp = sz;
+  if(nvma == NVMA)
+    goto badmapped;
+  vma[nvma].start = KERNBASE - MAXUSTACK;
+  vma[nvma].end = KERNBASE;
+  vma[nvma].off = 0;
+  vma[nvma].filesz = 0;
+  vma[nvma].writable = 1;
+  vma[nvma].shared = 0;
+  vma[nvma].ip = 0;
+  vma[nvma].shm = 0;
+  vma[nvma].stack = 1;
+  nvma++;
+  if(allocuvm(pgdir, KERNBASE - PGSIZE, KERNBASE) == 0)
+    goto badmapped;
+  sp = KERNBASE;
 
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
     if(argc >= MAXARG)
-      goto bad;
+      goto badmapped;
     sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
     if(copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
-      goto bad;
+      goto badmapped;
     ustack[3+argc] = sp;
   }
   ustack[3+argc] = 0;
@@ -85,23 +126,41 @@ exec(char *path, char **argv)
 
   sp -= (3+argc+1) * 4;
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
-    goto bad;
+    goto badmapped;
 
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  curproc->tstack = sp; //set up stack top
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  vmasyncall(p);
+  begin_op();
+  vmaput(p);
+  for(i = 0; i < nvma; i++){
+    p->vma[i] = vma[i];
+    if(vma[i].ip)
+      idup(ip);
+  }
+  p->vmowner = p;
+  iput(ip);
+  end_op();
+  // Under growlock(), so that reclaim() is not looking
+  // at the old page table when it is freed.
+  growlock(p);
+  oldpgdir = p->pgdir;
+  p->pgdir = pgdir;
+  p->sz = sz;
+  growunlock(p);
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
+  p->tstack = sp; //set up stack top
+  fpuload(p, 0);
+  if(p == myproc())
+    switchuvm(p);
+  if(oldpgdir)
+    freevm(oldpgdir);
   return 0;
 
  bad:
@@ -112,4 +171,12 @@ exec(char *path, char **argv)
     end_op();
   }
   return -1;
+
+ badmapped:
+  // ip is no longer locked or in a transaction.
+  freevm(pgdir);
+  begin_op();
+  iput(ip);
+  end_op();
+  return -1;
 }
@@ -23,6 +23,7 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  struct inode *next; // in icache, guarded by icache.lock
 };
 
 // table mapping major device number to
@@ -0,0 +1,100 @@
+// FPU and SSE state of user processes.
+//
+// The kernel itself uses neither (the Makefile compiles it so),
+// so the x87 and SSE registers of a CPU only ever hold the
+// state of a user process, and they are switched lazily. As a
+// process gives up the CPU, sched() calls fpusave(), which sets
+// CR0.TS; the first FPU or SSE instruction the next process
+// runs then raises the device-not-available trap, and fputrap()
+// loads that process's registers with fxrstor and clears TS. A
+// process that does not touch the FPU during a time slice costs
+// nothing more than setting TS.
+//
+// A process that did use it has its registers saved to p->fpu
+// with fxsave when it gives up the CPU, so its state is always
+// in memory while it is not running and it can resume on any
+// CPU. The CPU remembers whose state its registers still hold,
+// so a process that comes back to it before anyone else used
+// the FPU there skips the fxrstor.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+
+#define FCWINIT   0x037F    // x87: exceptions masked, 64-bit precision
+#define MXCSRINIT 0x1F80    // SSE: exceptions masked, round to nearest
+
+static struct fxsave fpuinitial;  // state of a new program
+static uint mxcsrmask;            // valid bits of mxcsr
+
+// Enable the FPU and SSE on this CPU, with CR0.TS set so that
+// the first use traps. The boot CPU also works out the initial
+// state, before startothers().
+void
+fpuinit(void)
+{
+  lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+  lcr0((rcr0() & ~(CR0_EM|CR0_TS)) | CR0_MP | CR0_NE);
+  if(mxcsrmask == 0){
+    fxsave(&fpuinitial);
+    mxcsrmask = fpuinitial.mxcsrmask ? fpuinitial.mxcsrmask : 0xFFBF;
+    memset(&fpuinitial, 0, sizeof(fpuinitial));
+    fpuinitial.fcw = FCWINIT;
+    fpuinitial.mxcsr = MXCSRINIT;
+  }
+  lcr0(rcr0() | CR0_TS);
+}
+
+// Handle the device-not-available trap, raised by the first
+// FPU or SSE instruction of a process after CR0.TS was set:
+// load its registers, unless this CPU's still hold them.
+void
+fputrap(void)
+{
+  struct cpu *c;
+  struct proc *p;
+
+  pushcli();
+  c = mycpu();
+  p = c->proc;
+  clts();
+  if(c->fpuproc != p || p->fpucpu != c){
+    fxrstor(&p->fpu);
+    c->fpuproc = p;
+    p->fpucpu = c;
+  }
+  popcli();
+}
+
+// Save the FPU registers of p, the current process, to p->fpu
+// if it has used them since they were last loaded or saved, and
+// set CR0.TS so that its next use traps again.
+void
+fpusave(struct proc *p)
+{
+  pushcli();
+  if((rcr0() & CR0_TS) == 0){
+    fxsave(&p->fpu);
+    lcr0(rcr0() | CR0_TS);
+  }
+  popcli();
+}
+
+// Give p the FPU state fx, or that of a new program if fx is 0.
+// p is the current process, or one that is not running. Bits
+// of mxcsr the CPU does not support are cleared, as fxrstor
+// would fault on them.
+void
+fpuload(struct proc *p, struct fxsave *fx)
+{
+  pushcli();
+  p->fpu = fx ? *fx : fpuinitial;
+  p->fpu.mxcsr &= mxcsrmask;
+  p->fpucpu = 0;
+  if(p == myproc())
+    lcr0(rcr0() | CR0_TS);
+  popcli();
+}
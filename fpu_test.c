@@ -0,0 +1,153 @@
+#include "types.h"
+#include "user.h"
+#include "syscall.h"
+#include "traps.h"
+
+// Floating point and SSE state is per process: several processes
+// hold different values in the x87 and SSE registers across
+// sleeps, which make the others run and use theirs, and compute
+// with vector code; each must find its own values. The control
+// words start out at their defaults after exec and are inherited
+// across fork. Built with SIMDFLAGS, see the Makefile.
+
+#define NCHILD 4
+#define ROUNDS 20
+#define N 256
+
+typedef float v4sf __attribute__((vector_size(16)));
+
+void fail(char *why)
+{
+    printf(1, "fpu_test: %s failed\n", why);
+    exit();
+}
+
+uint getmxcsr(void)
+{
+    uint v;
+
+    asm volatile("stmxcsr %0" : "=m" (v));
+    return v;
+}
+
+void setmxcsr(uint v)
+{
+    asm volatile("ldmxcsr %0" : : "m" (v));
+}
+
+ushort getfcw(void)
+{
+    ushort v;
+
+    asm volatile("fnstcw %0" : "=m" (v));
+    return v;
+}
+
+// Put v in every lane of %xmm0-%xmm7 and on the x87 stack, sleep
+// a tick in the middle of it, and return 0 if they all still
+// hold v afterwards.
+int hold(int v)
+{
+    int xmm[8][4], st, i, j;
+
+    asm volatile(
+        "movd %2, %%xmm0\n\t"
+        "pshufd $0, %%xmm0, %%xmm0\n\t"
+        "movdqa %%xmm0, %%xmm1\n\t"
+        "movdqa %%xmm0, %%xmm2\n\t"
+        "movdqa %%xmm0, %%xmm3\n\t"
+        "movdqa %%xmm0, %%xmm4\n\t"
+        "movdqa %%xmm0, %%xmm5\n\t"
+        "movdqa %%xmm0, %%xmm6\n\t"
+        "movdqa %%xmm0, %%xmm7\n\t"
+        "fildl %3\n\t"
+        // sleep(1), by hand so that no registers are touched
+        "pushl $1\n\t"
+        "pushl $0\n\t"
+        "movl %4, %%eax\n\t"
+        "int %5\n\t"
+        "addl $8, %%esp\n\t"
+        "fistpl %0\n\t"
+        "movdqu %%xmm0, 0(%1)\n\t"
+        "movdqu %%xmm1, 16(%1)\n\t"
+        "movdqu %%xmm2, 32(%1)\n\t"
+        "movdqu %%xmm3, 48(%1)\n\t"
+        "movdqu %%xmm4, 64(%1)\n\t"
+        "movdqu %%xmm5, 80(%1)\n\t"
+        "movdqu %%xmm6, 96(%1)\n\t"
+        "movdqu %%xmm7, 112(%1)\n\t"
+        : "=m" (st)
+        : "r" (xmm), "r" (v), "m" (v), "i" (SYS_sleep), "i" (T_SYSCALL)
+        : "eax", "memory", "xmm0", "xmm1", "xmm2", "xmm3",
+          "xmm4", "xmm5", "xmm6", "xmm7");
+    if(st != v)
+        return -1;
+    for(i = 0; i < 8; i++)
+        for(j = 0; j < 4; j++)
+            if(xmm[i][j] != v)
+                return -1;
+    return 0;
+}
+
+// Sum of a[i]*b[i] with a[i] = i and b[i] = k, in vectors.
+// Small integers, so the result is exact.
+float dot(int k)
+{
+    static v4sf a[N / 4], b[N / 4];
+    v4sf s = {0, 0, 0, 0};
+    int i;
+
+    for(i = 0; i < N; i++){
+        ((float *)a)[i] = i;
+        ((float *)b)[i] = k;
+    }
+    for(i = 0; i < N / 4; i++)
+        s += a[i] * b[i];
+    return s[0] + s[1] + s[2] + s[3];
+}
+
+int main(void)
+{
+    int i, k, pid, p[2];
+    char c;
+
+    if((getmxcsr() & 0xFFBF) != 0x1F80 || getfcw() != 0x37F)
+        fail("initial control words");
+
+    // Round toward zero: the child must inherit it.
+    setmxcsr(0x7F80);
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0){
+        if(getmxcsr() != 0x7F80)
+            fail("mxcsr after fork");
+        exit();
+    }
+    wait();
+    setmxcsr(0x1F80);
+
+    if(pipe(p) < 0)
+        fail("pipe");
+    for(k = 1; k <= NCHILD; k++){
+        if((pid = fork()) < 0)
+            fail("fork");
+        if(pid == 0){
+            c = 1;
+            for(i = 0; i < ROUNDS && c; i++)
+                if(hold(k * 0x01010101 + i) < 0 ||
+                   dot(k) != (float)k * (N * (N - 1) / 2))
+                    c = 0;
+            write(p[1], &c, 1);
+            exit();
+        }
+    }
+    for(k = 0; k < NCHILD; k++)
+        if(read(p[0], &c, 1) != 1 || !c)
+            fail("registers kept");
+    for(k = 0; k < NCHILD; k++)
+        wait();
+    if(hold(-1) < 0)
+        fail("registers kept by parent");
+    printf(1, "fpu_test: OK\n");
+    exit();
+}
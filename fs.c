@@ -163,20 +163,31 @@ bfree(int dev, uint b)
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+//
+// The cache grows on demand: when no entry is free, iget()
+// takes a new inode from the slab cache. Entries are never
+// given back, an unreferenced one is recycled instead.
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *inodes;       // every cached inode
+  struct kmem_cache *cache;
 } icache;
 
+static void
+inodector(void *p)
+{
+  struct inode *ip = p;
+
+  ip->ref = 0;
+  initsleeplock(&ip->lock, "inode");
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode), inodector);
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -247,7 +258,7 @@ iget(uint dev, uint inum)
 
   // Is the inode already cached?
   empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
+  for(ip = icache.inodes; ip; ip = ip->next){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
@@ -257,9 +268,13 @@ iget(uint dev, uint inum)
       empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Recycle an inode cache entry, or grow the cache.
+  if(empty == 0){
+    if((empty = kmem_cache_alloc(icache.cache)) == 0)
+      panic("iget: no inodes");
+    empty->next = icache.inodes;
+    icache.inodes = empty;
+  }
 
   ip = empty;
   ip->dev = dev;
@@ -411,6 +426,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcacheinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -499,6 +515,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
+    pcacheupdate(ip, off, (char*)bp->data + off%BSIZE, m);
     log_write(bp);
     brelse(bp);
   }
@@ -1,6 +1,30 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, or physically
+// contiguous blocks of 2^order pages.
+//
+// Free memory is kept by a binary buddy allocator (Knowlton,
+// "A Fast Storage Allocator", CACM 8(10), 1965). A block of
+// order k is 2^k pages aligned to its size; its buddy is the
+// block whose physical address differs only in bit k of the
+// page number. Freeing a block merges it with its buddy as long
+// as the buddy is free too.
+//
+// At boot, free memory is only recorded as a few extents of page
+// numbers. Blocks are carved from them into the buddy lists when
+// the lists run dry, so boot does not touch every page.
+//
+// Each NUMA node (see acpi.c) has a pool of its own: buddy lists,
+// extents and zeroed pages, under a lock of its own. Blocks never
+// merge across nodes. Pages come from the pool of the running
+// CPU's node, and from the nearest other node when that pool is
+// empty. Pages of user memory, from kallocuser() and friends,
+// follow the process's setmempolicy() instead.
+//
+// How much memory there is comes from the BIOS memory map that
+// bootasm.S leaves at E820MAP, or from a multiboot loader's map.
+// The per-page arrays are sized to it and placed right after the
+// kernel.
 
 #include "types.h"
 #include "defs.h"
@@ -8,72 +32,626 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
+#include "x86.h"
+#include "mman.h"
 
 void freerange(void *vstart, void *vend);
+static char* zpop(int);
+static char* znear(int, int);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+#define MAXORDER 10             // largest block is 4 MB
+#define NEXTENT  16             // per node
+#define NRAM     16             // usable ranges in the memory map
+#define NE820    64             // most entries bootasm.S can have left
+#define DEFPHYS  0xE000000      // memory assumed if there is no map
+#define MBMAGIC  0x2BADB002     // in %eax from a multiboot loader
+#define EARLY    (4*1024*1024/PGSIZE)  // pages kinit1() frees, node 0
+
+struct extent {
+  uint start;                   // first page number
+  uint end;                     // page number after the last
+};
+
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
-struct {
+// Each CPU keeps a magazine of free pages so that most kalloc()
+// and kfree() calls take no shared lock. A magazine is refilled
+// from, and drained to, the buddy lists MAGBATCH pages at a time.
+// It only holds pages of the CPU's own node. Its lock is only
+// contended when kalloc() runs out of memory and drains the
+// magazines of other CPUs.
+#define MAGSIZE  64
+#define MAGBATCH 32
+
+struct magazine {
   struct spinlock lock;
-  int use_lock;
   struct run *freelist;
+  int n;
+};
+
+// Idle CPUs keep a pool of NZERO zeroed pages per node, so that
+// kzalloc() usually need not clear the page itself.
+#define NZERO    128
+
+struct pool {
+  struct spinlock lock;
+  int npages;                 // pages given to the pool
+  struct run *free[MAXORDER+1];   // free blocks of each order
+  int nfree[MAXORDER+1];
+  struct extent ext[NEXTENT]; // free pages not in the lists yet
+  struct spinlock zlock;      // protects zeroed and nzero
+  struct run *zeroed;         // allocated pages, all zero but the link
+  int nzero;
+};
+
+struct {
+  int use_lock;
+  int npages;                 // pages given to the allocator
+  uint maxpage;               // page number of phystop
+  uchar *order;               // order+1 at the first page of a free block
+  uchar *node;                // node of each page
+  ushort *ref;                // references to pages from kalloc()
+  struct magazine mag[NCPU];  // used once use_lock is set
+  struct pool pool[NNODE];
+  uchar near[NNODE][NNODE];   // for each node, all nodes nearest first
 } kmem;
 
+#define POOL(pn) (&kmem.pool[kmem.node[pn]])
+
+uint phystop;                 // top of usable physical memory
+uint mbmagic, mbinfo;         // saved by entry.S
+
+static struct extent ram[NRAM]; // usable memory, in bytes
+static int nram;
+
+// Physical memory map entry, as returned by int 0x15 e820.
+// A multiboot map has the same entries, each preceded by its size.
+struct e820 {
+  uint addr, addrhi;
+  uint len, lenhi;
+  uint type;                  // 1 is usable memory
+};
+
+// Note usable memory described by e, clipped to what the
+// kernel can map.
+static void
+addram(struct e820 *e)
+{
+  uint start, end;
+
+  if(e->type != 1 || e->addrhi || nram == NRAM)
+    return;
+  end = e->addr + e->len;
+  if(e->lenhi || end < e->addr || end > MAXPHYS)
+    end = MAXPHYS;
+  start = PGROUNDUP(e->addr);
+  end = PGROUNDDOWN(end);
+  if(start >= end)
+    return;
+  ram[nram].start = start;
+  ram[nram].end = end;
+  nram++;
+  if(end > phystop)
+    phystop = end;
+}
+
+// Find the usable physical memory, in the memory map of a
+// multiboot loader if there was one, else in the one from
+// bootasm.S. Both lie in the low 4 MB, mapped by entrypgdir.
+static void
+memdetect(void)
+{
+  uint *mb, *p, *pe;
+  struct e820 *e, *ee, def;
+
+  if(mbmagic == MBMAGIC && mbinfo < 4*1024*1024){
+    mb = P2V(mbinfo);
+    if(mb[0] & (1<<6) && mb[12] + mb[11] <= 4*1024*1024){
+      p = P2V(mb[12]);
+      pe = P2V(mb[12] + mb[11]);
+      for(; p < pe; p = (uint*)((char*)p + p[0] + 4))
+        addram((struct e820*)(p + 1));
+    }
+  } else {
+    e = (struct e820*)P2V(E820MAP + 4);
+    ee = e + *(uint*)P2V(E820MAP);
+    if(ee > e + NE820)
+      ee = e + NE820;
+    for(; e < ee; e++)
+      addram(e);
+  }
+  if(nram == 0){
+    memset(&def, 0, sizeof(def));
+    def.len = DEFPHYS;
+    def.type = 1;
+    addram(&def);
+  }
+}
+
+// Give the usable parts of [vstart, vend) to freerange().
+static void
+freeram(char *vstart, char *vend)
+{
+  struct extent *r;
+
+  for(r = ram; r < &ram[nram]; r++){
+    if(V2P(vend) <= r->start || V2P(vstart) >= r->end)
+      continue;
+    freerange(V2P(vstart) > r->start ? vstart : P2V(r->start),
+              V2P(vend) < r->end ? vend : P2V(r->end));
+  }
+}
+
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
-// the pages mapped by entrypgdir on free list.
+// the pages mapped by entrypgdir on free list. The page arrays
+// take the start of them. They all go to node 0, as the NUMA
+// topology is not known yet.
 // 2. main() calls kinit2() with the rest of the physical pages
-// after installing a full page table that maps them on all cores.
+// after installing a full page table that maps them on all cores,
+// and after acpiinit() has assigned them to nodes.
 void
 kinit1(void *vstart, void *vend)
 {
-  initlock(&kmem.lock, "kmem");
+  char *p;
+  int n;
+
+  for(n = 0; n < NNODE; n++){
+    initlock(&kmem.pool[n].lock, "kmem");
+    initlock(&kmem.pool[n].zlock, "kzero");
+  }
+  for(n = 0; n < NCPU; n++)
+    initlock(&kmem.mag[n].lock, "kmag");
   kmem.use_lock = 0;
-  freerange(vstart, vend);
+  memdetect();
+  kmem.maxpage = phystop / PGSIZE;
+  p = (char*)PGROUNDUP((uint)vstart);
+  kmem.order = (uchar*)p;
+  memset(kmem.order, 0, kmem.maxpage);
+  p += (kmem.maxpage + 1) & ~1;
+  kmem.node = (uchar*)p;
+  memset(kmem.node, 0, kmem.maxpage);
+  p += (kmem.maxpage + 1) & ~1;
+  kmem.ref = (ushort*)p;
+  p += kmem.maxpage * sizeof(ushort);
+  if(p > (char*)vend)
+    panic("kinit1: too much memory");
+  freeram(p, vend);
 }
 
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  int n, i, j, t;
+  uchar *near;
+
+  // Order the nodes by distance from each node.
+  for(n = 0; n < nnode; n++){
+    near = kmem.near[n];
+    for(i = 0; i < nnode; i++)
+      near[i] = i;
+    for(i = 1; i < nnode; i++){
+      t = near[i];
+      for(j = i; j > 0 && nodedist(n, near[j-1]) > nodedist(n, t); j--)
+        near[j] = near[j-1];
+      near[j] = t;
+    }
+    if(near[0] != n){
+      // Local first, even if the table says otherwise.
+      for(i = 0; near[i] != n; i++)
+        ;
+      for(; i > 0; i--)
+        near[i] = near[i-1];
+      near[0] = n;
+    }
+  }
+  freeram(vstart, vend);
   kmem.use_lock = 1;
 }
 
+// Assign the pages of physical memory [start, end) to node.
+// Called by acpiinit() before kinit2() frees them; the pages
+// kinit1() freed stay with node 0.
+void
+knodemem(uint start, uint end, int node)
+{
+  uint pn;
+
+  start = PGROUNDUP(start) / PGSIZE;
+  end = end / PGSIZE;
+  if(start < EARLY)
+    start = EARLY;
+  for(pn = start; pn < end && pn < kmem.maxpage; pn++)
+    kmem.node[pn] = node;
+}
+
+// Record the free pages [start, end) in the pool of their
+// node, merging them with an extent they follow.
+static void
+addextent(struct pool *pl, uint start, uint end)
+{
+  struct extent *e;
+
+  pl->npages += end - start;
+  for(e = pl->ext; e < &pl->ext[NEXTENT]; e++){
+    if(e->start < e->end && e->end == start){
+      e->end = end;
+      return;
+    }
+  }
+  for(e = pl->ext; e < &pl->ext[NEXTENT]; e++){
+    if(e->start == e->end){
+      e->start = start;
+      e->end = end;
+      return;
+    }
+  }
+  panic("freerange: too many extents");
+}
+
+// Record [vstart, vend) as free, split by node.
 void
 freerange(void *vstart, void *vend)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
-    kfree(p);
+  uint start, end, pn;
+
+  start = V2P(PGROUNDUP((uint)vstart)) / PGSIZE;
+  end = V2P(vend) / PGSIZE;
+  if(start >= end)
+    return;
+  kmem.npages += end - start;
+  while(start < end){
+    for(pn = start; pn < end && kmem.node[pn] == kmem.node[start]; pn++)
+      ;
+    addextent(POOL(start), start, pn);
+    start = pn;
+  }
+}
+
+// Number of physical pages the allocator manages.
+int
+kpages(void)
+{
+  return kmem.npages;
+}
+
+//PAGEBREAK!
+// Buddy lists. Caller holds the pool's lock if use_lock is set.
+
+static void
+pushblock(struct pool *pl, uint pn, int k)
+{
+  struct run *r = (struct run*)P2V(pn * PGSIZE);
+
+  r->prev = 0;
+  r->next = pl->free[k];
+  if(r->next)
+    r->next->prev = r;
+  pl->free[k] = r;
+  pl->nfree[k]++;
+  kmem.order[pn] = k + 1;
+}
+
+static void
+unlinkblock(struct pool *pl, uint pn, int k)
+{
+  struct run *r = (struct run*)P2V(pn * PGSIZE);
+
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    pl->free[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  pl->nfree[k]--;
+  kmem.order[pn] = 0;
+}
+
+static void
+buddyfree(struct pool *pl, char *v, int k)
+{
+  uint pn, b;
+
+  pn = V2P(v) / PGSIZE;
+  for(; k < MAXORDER; k++){
+    b = pn ^ (1 << k);
+    if(b >= kmem.maxpage || kmem.order[b] != k + 1 ||
+       kmem.node[b] != kmem.node[pn])
+      break;
+    unlinkblock(pl, b, k);
+    pn &= ~(1 << k);
+  }
+  pushblock(pl, pn, k);
+}
+
+// Move the largest aligned block at the start of an extent
+// into the buddy lists. Returns 0 if all extents are used up.
+static int
+carve(struct pool *pl)
+{
+  struct extent *e;
+  uint pn;
+  int k;
+
+  for(e = pl->ext; e < &pl->ext[NEXTENT]; e++){
+    if(e->start == e->end)
+      continue;
+    pn = e->start;
+    for(k = MAXORDER; k > 0; k--)
+      if(pn % (1 << k) == 0 && pn + (1 << k) <= e->end)
+        break;
+    e->start += 1 << k;
+    buddyfree(pl, P2V(pn * PGSIZE), k);
+    return 1;
+  }
+  return 0;
 }
+
+static char*
+buddyalloc(struct pool *pl, int k)
+{
+  uint pn;
+  int j;
+
+  for(;;){
+    for(j = k; j <= MAXORDER && pl->free[j] == 0; j++)
+      ;
+    if(j <= MAXORDER)
+      break;
+    if(!carve(pl))
+      return 0;
+  }
+  pn = V2P(pl->free[j]) / PGSIZE;
+  unlinkblock(pl, pn, j);
+  // Split, keeping the lower half and freeing the upper.
+  while(j > k){
+    j--;
+    pushblock(pl, pn + (1 << j), j);
+  }
+  return P2V(pn * PGSIZE);
+}
+
+//PAGEBREAK!
+// Placement.
+
+// The node to allocate from on this CPU: for user memory, the
+// one setmempolicy() chose for the current process. Sets *strict
+// if no other node will do.
+static int
+allocnode(int user, int *strict)
+{
+  struct proc *p;
+  int n;
+
+  *strict = 0;
+  pushcli();
+  p = mycpu()->proc;
+  if(!user || p == 0 || p->mpol == MPOL_LOCAL || p->mpolnode >= nnode)
+    n = mycpu()->node;
+  else if(p->mpol == MPOL_INTERLEAVE)
+    n = p->mpolnext++ % nnode;
+  else {
+    n = p->mpolnode;
+    *strict = p->mpol == MPOL_BIND;
+  }
+  popcli();
+  return n;
+}
+
+// Allocate 2^order pages from node, or the nearest node that
+// has them unless strict.
+static char*
+nodealloc(int node, int strict, int order)
+{
+  struct pool *pl;
+  char *v;
+  int i;
+
+  for(i = 0; i < nnode; i++){
+    pl = &kmem.pool[kmem.near[node][i]];
+    acquire(&pl->lock);
+    v = buddyalloc(pl, order);
+    release(&pl->lock);
+    if(v || strict)
+      return v;
+  }
+  return 0;
+}
+
+// Give the pages in the magazine of CPU c back to the buddy
+// lists of its node.
+static void
+drain(int c)
+{
+  struct magazine *m = &kmem.mag[c];
+  struct pool *pl = &kmem.pool[cpus[c].node];
+  struct run *r;
+
+  acquire(&m->lock);
+  acquire(&pl->lock);
+  while((r = m->freelist) != 0){
+    m->freelist = r->next;
+    buddyfree(pl, (char*)r, 0);
+  }
+  m->n = 0;
+  release(&pl->lock);
+  release(&m->lock);
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Free the 2^order pages at v, which normally should have
+// been returned by kallocpages(order).
+void
+kfreepages(char *v, int order)
+{
+  struct pool *pl;
+
+  if(order < 0 || order > MAXORDER || V2P(v) % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > phystop)
+    panic("kfreepages");
+
+#ifdef MEMDEBUG
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  pl = POOL(V2P(v) / PGSIZE);
+  if(kmem.use_lock)
+    acquire(&pl->lock);
+  buddyfree(pl, v, order);
+  if(kmem.use_lock)
+    release(&pl->lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size, placed as allocnode(user) says.
+static char*
+blockalloc(int order, int user)
+{
+  char *v;
+  int node, strict;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(!kmem.use_lock)
+    return buddyalloc(&kmem.pool[0], order);
+
+  node = allocnode(user, &strict);
+  if((v = nodealloc(node, strict, order)) != 0 || order == 0)
+    return v;
+  // Pages in this CPU's magazine may be keeping
+  // blocks from merging.
+  pushcli();
+  drain(cpuid());
+  popcli();
+  return nodealloc(node, strict, order);
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns 0 if that cannot be done.
+char*
+kallocpages(int order)
+{
+  return blockalloc(order, 0);
+}
+
+// Allocate 2^order pages of user memory, as kallocpages().
+char*
+kallocuserpages(int order)
+{
+  return blockalloc(order, 1);
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by v, which should have been returned by a call to
+// kalloc(), and free it when none are left. Pages of
+// another node go straight back to their own pool.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct magazine *m;
+  struct pool *pl;
+  ushort n;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
     panic("kfree");
+  if((n = xaddw(&kmem.ref[V2P(v) / PGSIZE], -1)) != 1){
+    if(n == 0)
+      panic("kfree: ref");
+    return;
+  }
+  if(!kmem.use_lock){
+    kfreepages(v, 0);
+    return;
+  }
 
+#ifdef MEMDEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  pl = POOL(V2P(v) / PGSIZE);
+  pushcli();
+  if(pl != &kmem.pool[mycpu()->node]){
+    popcli();
+    kfreepages(v, 0);
+    return;
+  }
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  r->next = m->freelist;
+  m->freelist = r;
+  if(++m->n > MAGSIZE){
+    acquire(&pl->lock);
+    while(m->n > MAGSIZE - MAGBATCH){
+      r = m->freelist;
+      m->freelist = r->next;
+      m->n--;
+      buddyfree(pl, (char*)r, 0);
+    }
+    release(&pl->lock);
+  }
+  release(&m->lock);
+  popcli();
+}
+
+// Allocate one page from node, or the nearest node that has
+// one unless strict.
+static char*
+pagealloc(int node, int strict)
+{
+  struct run *r;
+  struct magazine *m;
+  struct pool *pl;
+  int c;
+
+  if(!kmem.use_lock){
+    if((r = (struct run*)kallocpages(0)) != 0)
+      kmem.ref[V2P(r) / PGSIZE] = 1;
+    return (char*)r;
+  }
+
+  r = 0;
+  pushcli();
+  if(node == mycpu()->node){
+    m = &kmem.mag[cpuid()];
+    acquire(&m->lock);
+    if(m->freelist == 0){
+      pl = &kmem.pool[node];
+      acquire(&pl->lock);
+      while(m->n < MAGBATCH && (r = (struct run*)buddyalloc(pl, 0)) != 0){
+        r->next = m->freelist;
+        m->freelist = r;
+        m->n++;
+      }
+      release(&pl->lock);
+    }
+    r = m->freelist;
+    if(r){
+      m->freelist = r->next;
+      m->n--;
+    }
+    release(&m->lock);
+  }
+  popcli();
+  if(r == 0 && (r = (struct run*)nodealloc(node, strict, 0)) == 0){
+    // The free pages left may all sit in magazines.
+    for(c = 0; c < ncpu; c++)
+      drain(c);
+    if((r = (struct run*)nodealloc(node, strict, 0)) == 0)
+      return znear(node, strict);  // last resort, ref already set
+  }
+  kmem.ref[V2P(r) / PGSIZE] = 1;
+  return (char*)r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -82,15 +660,220 @@ kfree(char *v)
 char*
 kalloc(void)
 {
+  int node, strict;
+
+  node = allocnode(0, &strict);
+  return pagealloc(node, strict);
+}
+
+// Allocate one page of user memory, as kalloc().
+char*
+kallocuser(void)
+{
+  int node, strict;
+
+  node = allocnode(1, &strict);
+  return pagealloc(node, strict);
+}
+
+//PAGEBREAK!
+// Zeroed pages.
+
+// Take a page from the zeroed pool of node, 0 if it is empty.
+static char*
+zpop(int node)
+{
+  struct pool *pl = &kmem.pool[node];
   struct run *r;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  acquire(&pl->zlock);
+  r = pl->zeroed;
+  if(r){
+    pl->zeroed = r->next;
+    pl->nzero--;
+  }
+  release(&pl->zlock);
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    r->next = 0;
   return (char*)r;
 }
 
+// Take a zeroed page of node, or of the nearest node that has
+// one unless strict.
+static char*
+znear(int node, int strict)
+{
+  char *v;
+  int i;
+
+  for(i = 0; i < nnode; i++){
+    v = zpop(kmem.near[node][i]);
+    if(v || strict)
+      return v;
+  }
+  return 0;
+}
+
+// Allocate one zeroed page, placed as allocnode(user) says.
+static char*
+zalloc(int user)
+{
+  char *v;
+  int node, strict;
+
+  node = allocnode(user, &strict);
+  if((v = zpop(node)) == 0 && (v = pagealloc(node, strict)) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Allocate one zeroed page, as kalloc().
+char*
+kzalloc(void)
+{
+  return zalloc(0);
+}
+
+// Allocate one zeroed page of user memory, as kallocuser().
+char*
+kzallocuser(void)
+{
+  return zalloc(1);
+}
+
+// Zero one more page for the pool of this CPU's node if it
+// is short. Called by scheduler() when it found nothing to run.
+void
+kzeroidle(void)
+{
+  struct pool *pl;
+  struct run *r;
+
+  pushcli();
+  pl = &kmem.pool[mycpu()->node];
+  popcli();
+  if(pl->nzero >= NZERO || (r = (struct run*)kalloc()) == 0)
+    return;
+  memset(r, 0, PGSIZE);
+  pl = POOL(V2P(r) / PGSIZE);
+  acquire(&pl->zlock);
+  r->next = pl->zeroed;
+  pl->zeroed = r;
+  pl->nzero++;
+  release(&pl->zlock);
+}
+
+// Add a reference to page v, so that it is shared by
+// one more kfree().
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
+    panic("kref");
+  xaddw(&kmem.ref[V2P(v) / PGSIZE], 1);
+}
+
+// Number of references to page v.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v) / PGSIZE];
+}
+
+// Turn the block at v from kallocpages(order) into 2^order
+// pages that are each given back with kfree().
+void
+ksplitpages(char *v, int order)
+{
+  uint pn, i;
+
+  if(order < 0 || order > MAXORDER || V2P(v) % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > phystop)
+    panic("ksplitpages");
+  pn = V2P(v) / PGSIZE;
+  for(i = 0; i < 1 << order; i++)
+    kmem.ref[pn + i] = 1;
+}
+
+//PAGEBREAK!
+// Count the free pages of node: blocks of each order are added
+// to nfree, pages cached by its CPUs to *cached, and pages not
+// yet carved into blocks to *uncarved. Returns the total, which
+// includes the zeroed pool.
+static int
+freecount(int node, int *nfree, int *cached, int *uncarved)
+{
+  struct pool *pl = &kmem.pool[node];
+  int k, freepages, i, c, u;
+
+  acquire(&pl->lock);
+  for(k = 0; k <= MAXORDER; k++)
+    nfree[k] += pl->nfree[k];
+  u = 0;
+  for(i = 0; i < NEXTENT; i++)
+    u += pl->ext[i].end - pl->ext[i].start;
+  freepages = u;
+  for(k = 0; k <= MAXORDER; k++)
+    freepages += pl->nfree[k] << k;
+  release(&pl->lock);
+  c = 0;
+  for(i = 0; i < ncpu; i++)
+    if(cpus[i].node == node)
+      c += kmem.mag[i].n;  // racy, good enough for a report
+  *cached += c;
+  *uncarved += u;
+  return freepages + c + pl->nzero;
+}
+
+// Number of free physical pages of node, or of all nodes
+// if node is -1.
+int
+knfree(int node)
+{
+  int nfree[MAXORDER+1], cached, uncarved, n, freepages;
+
+  memset(nfree, 0, sizeof(nfree));
+  cached = uncarved = freepages = 0;
+  for(n = 0; n < nnode; n++)
+    if(node < 0 || n == node)
+      freepages += freecount(n, nfree, &cached, &uncarved);
+  return freepages;
+}
+
+// Number of physical pages of node.
+int
+knodepages(int node)
+{
+  return kmem.pool[node].npages;
+}
+
+// Print free blocks of each order and how fragmented free
+// memory is: for each order, the percentage of free pages that
+// sit in smaller blocks and so cannot satisfy a request of that
+// order (Gorman's unusable free space index). Pages cached by
+// CPUs and zeroed pages count as order-0 blocks. Bound to ^F on the console.
+void
+kmemdump(void)
+{
+  int k, freepages, small, cached, uncarved, nzero, n, f;
+  int nfree[MAXORDER+1];
+
+  memset(nfree, 0, sizeof(nfree));
+  freepages = cached = uncarved = nzero = 0;
+  for(n = 0; n < nnode; n++){
+    f = freecount(n, nfree, &cached, &uncarved);
+    if(nnode > 1)
+      cprintf("node %d: free %d of %d pages\n", n, f, kmem.pool[n].npages);
+    freepages += f;
+    nzero += kmem.pool[n].nzero;
+  }
+  cprintf("free %d of %d pages, %d cached by cpus, %d zeroed, "
+          "%d never used\n", freepages, kmem.npages, cached, nzero,
+          uncarved);
+  small = cached + nzero;
+  for(k = 0; k <= MAXORDER; k++){
+    cprintf("order %d: %d free, unusable %d%%\n", k, nfree[k],
+            freepages ? small * 100 / freepages : 0);
+    small += nfree[k] << k;
+  }
+}
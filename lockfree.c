@@ -0,0 +1,236 @@
+#include "types.h"
+#include "user.h"
+#include "atomic.h"
+#include "lockfree.h"
+
+// Lock-free data structures, see lockfree.h.
+
+static int
+pow2(uint n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+// single producer, single consumer ring
+
+int
+spsc_init(struct spsc_ring *r, void **slots, uint n)
+{
+    if(!pow2(n))
+        return -1;
+    r->head = r->tail = 0;
+    r->mask = n - 1;
+    r->slots = slots;
+    return 0;
+}
+
+int
+spsc_push(struct spsc_ring *r, void *v)
+{
+    uint t = r->tail;
+
+    if(t - r->head > r->mask)
+        return -1;
+    r->slots[t & r->mask] = v;
+    atomic_barrier();   // slot before tail
+    r->tail = t + 1;
+    return 0;
+}
+
+int
+spsc_pop(struct spsc_ring *r, void **v)
+{
+    uint h = r->head;
+
+    if(h == r->tail)
+        return -1;
+    atomic_barrier();   // tail before slot
+    *v = r->slots[h & r->mask];
+    atomic_barrier();   // slot before head
+    r->head = h + 1;
+    return 0;
+}
+
+// bounded MPMC queue (D. Vyukov): each cell has a sequence
+// number that tells whether it is ready for the producer or
+// the consumer holding the matching ticket.
+
+int
+mpmc_init(struct mpmc_queue *q, struct mpmc_cell *cells, uint n)
+{
+    uint i;
+
+    if(!pow2(n))
+        return -1;
+    for(i = 0; i < n; i++)
+        cells[i].seq = i;
+    q->head = q->tail = 0;
+    q->mask = n - 1;
+    q->cells = cells;
+    return 0;
+}
+
+int
+mpmc_push(struct mpmc_queue *q, void *v)
+{
+    struct mpmc_cell *c;
+    uint pos = q->tail;
+    int dif;
+
+    for(;;){
+        c = &q->cells[pos & q->mask];
+        dif = (int)(c->seq - pos);
+        if(dif == 0){
+            if(atomic_cas(&q->tail, pos, pos + 1))
+                break;
+        } else if(dif < 0)
+            return -1;      // full
+        pos = q->tail;
+    }
+    c->val = v;
+    atomic_barrier();
+    c->seq = pos + 1;
+    return 0;
+}
+
+int
+mpmc_pop(struct mpmc_queue *q, void **v)
+{
+    struct mpmc_cell *c;
+    uint pos = q->head;
+    int dif;
+
+    for(;;){
+        c = &q->cells[pos & q->mask];
+        dif = (int)(c->seq - (pos + 1));
+        if(dif == 0){
+            if(atomic_cas(&q->head, pos, pos + 1))
+                break;
+        } else if(dif < 0)
+            return -1;      // empty
+        pos = q->head;
+    }
+    *v = c->val;
+    atomic_barrier();
+    c->seq = pos + q->mask + 1;
+    return 0;
+}
+
+// Treiber stack with tagged top
+
+#define NODE(top) ((struct lf_node*)(uint)(top))
+#define TAG(top) ((uint)((top) >> 32))
+#define TOP(n, tag) ((unsigned long long)(tag) << 32 | (uint)(n))
+
+void
+lfstack_init(struct lf_stack *s)
+{
+    s->top = 0;
+}
+
+void
+lfstack_push(struct lf_stack *s, struct lf_node *n)
+{
+    unsigned long long old;
+
+    do {
+        old = s->top;
+        n->next = NODE(old);
+    } while(!atomic_cas64(&s->top, old, TOP(n, TAG(old) + 1)));
+}
+
+struct lf_node*
+lfstack_pop(struct lf_stack *s)
+{
+    unsigned long long old;
+    struct lf_node *n;
+
+    do {
+        old = s->top;
+        if((n = NODE(old)) == 0)
+            return 0;
+        // n may be popped and pushed again by now, then
+        // the tag has changed and the swap fails
+    } while(!atomic_cas64(&s->top, old, TOP(n->next, TAG(old) + 1)));
+    return n;
+}
+
+// hash map with linear probing
+
+int
+lfhash_init(struct lf_hash *h, struct lf_entry *tab, uint n)
+{
+    if(!pow2(n))
+        return -1;
+    memset(tab, 0, n * sizeof(tab[0]));
+    h->mask = n - 1;
+    h->tab = tab;
+    return 0;
+}
+
+// entry owning key, claiming a free one if needed
+static struct lf_entry*
+lookup(struct lf_hash *h, uint key, int claim)
+{
+    struct lf_entry *e;
+    uint i, k;
+
+    if(key == 0)
+        return 0;
+    i = key * 2654435761u;
+    for(k = 0; k <= h->mask; k++, i++){
+        e = &h->tab[i & h->mask];
+        if(e->key == key)
+            return e;
+        if(e->key == 0){
+            if(!claim)
+                return 0;
+            if(atomic_cas(&e->key, 0, key) || e->key == key)
+                return e;
+        }
+    }
+    return 0;
+}
+
+int
+lfhash_put(struct lf_hash *h, uint key, uint val)
+{
+    struct lf_entry *e;
+
+    if((e = lookup(h, key, 1)) == 0)
+        return -1;
+    e->val = val;
+    return 0;
+}
+
+int
+lfhash_add(struct lf_hash *h, uint key, uint delta)
+{
+    struct lf_entry *e;
+
+    if((e = lookup(h, key, 1)) == 0)
+        return -1;
+    atomic_fetch_add(&e->val, delta);
+    return 0;
+}
+
+int
+lfhash_get(struct lf_hash *h, uint key, uint *val)
+{
+    struct lf_entry *e;
+    uint v;
+
+    if((e = lookup(h, key, 0)) == 0 || (v = e->val) == 0)
+        return -1;
+    *val = v;
+    return 0;
+}
+
+void
+lfhash_del(struct lf_hash *h, uint key)
+{
+    struct lf_entry *e;
+
+    if((e = lookup(h, key, 0)) != 0)
+        e->val = 0;
+}
@@ -0,0 +1,78 @@
+// Lock-free data structures for threads (see thread.h)
+// Built on atomic.h. None of them allocate: the caller passes
+// the storage, whose size must be a power of two.
+
+// single producer, single consumer ring
+struct spsc_ring {
+    volatile uint head;          // next slot to pop, consumer only
+    char pad[60];                // keep head and tail on own lines
+    volatile uint tail;          // next slot to push, producer only
+    uint mask;
+    void **slots;
+};
+
+int spsc_init(struct spsc_ring *r, void **slots, uint n);
+// -1 if full
+int spsc_push(struct spsc_ring *r, void *v);
+// -1 if empty
+int spsc_pop(struct spsc_ring *r, void **v);
+
+// bounded multi producer, multi consumer queue
+struct mpmc_cell {
+    volatile uint seq;
+    void *val;
+};
+
+struct mpmc_queue {
+    volatile uint head;
+    char pad[60];
+    volatile uint tail;
+    uint mask;
+    struct mpmc_cell *cells;
+};
+
+int mpmc_init(struct mpmc_queue *q, struct mpmc_cell *cells, uint n);
+// -1 if full
+int mpmc_push(struct mpmc_queue *q, void *v);
+// -1 if empty
+int mpmc_pop(struct mpmc_queue *q, void **v);
+
+// Treiber stack of caller nodes, the top pointer carries a
+// tag bumped on every change so a recycled node cannot fool
+// the compare and swap (ABA). Popped nodes may be reused but
+// their memory must stay mapped.
+struct lf_node {
+    struct lf_node *next;
+};
+
+struct lf_stack {
+    volatile unsigned long long top;   // node in low word, tag in high
+} __attribute__((aligned(8)));
+
+void lfstack_init(struct lf_stack *s);
+void lfstack_push(struct lf_stack *s, struct lf_node *n);
+// 0 if empty
+struct lf_node *lfstack_pop(struct lf_stack *s);
+
+// open addressing hash map from keys to values, 0 is
+// reserved in both: key 0 is not allowed and value 0
+// means absent. Keys are never removed, lfhash_del only
+// clears the value, so the table only fills up.
+struct lf_entry {
+    volatile uint key;
+    volatile uint val;
+};
+
+struct lf_hash {
+    uint mask;
+    struct lf_entry *tab;
+};
+
+int lfhash_init(struct lf_hash *h, struct lf_entry *tab, uint n);
+// -1 if the table is full
+int lfhash_put(struct lf_hash *h, uint key, uint val);
+// adds delta to the value, -1 if the table is full
+int lfhash_add(struct lf_hash *h, uint key, uint delta);
+// -1 if absent
+int lfhash_get(struct lf_hash *h, uint key, uint *val);
+void lfhash_del(struct lf_hash *h, uint key);
@@ -0,0 +1,136 @@
+#include "types.h"
+#include "user.h"
+#include "thread.h"
+#include "atomic.h"
+#include "lockfree.h"
+
+// Exercises lockfree.h from several threads at once.
+
+#define N 20000
+#define NNODES 256
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+struct spsc_ring ring;
+void *ringslots[64];
+struct mpmc_queue queue;
+struct mpmc_cell cells[64];
+struct lf_stack stack;
+struct lf_node nodes[NNODES];
+struct lf_hash hash;
+struct lf_entry entries[1024];
+
+void
+fail(char *what)
+{
+    printf(1, "lockfree_test: %s FAILED\n", what);
+    exit();
+}
+
+void
+spsc_producer(void *arg)
+{
+    uint i;
+
+    for(i = 1; i <= N; i++)
+        while(spsc_push(&ring, (void *)i) < 0)
+            atomic_pause();
+}
+
+void
+mpmc_producer(void *arg)
+{
+    uint i, base = (uint)arg;
+
+    for(i = 1; i <= N; i++)
+        while(mpmc_push(&queue, (void *)(base + i)) < 0)
+            atomic_pause();
+}
+
+void
+stack_worker(void *arg)
+{
+    struct lf_node *n;
+    int i;
+
+    for(i = 0; i < N; i++){
+        if((n = lfstack_pop(&stack)) != 0)
+            lfstack_push(&stack, n);
+    }
+}
+
+void
+hash_worker(void *arg)
+{
+    uint k;
+
+    for(k = 1; k <= 500; k++)
+        lfhash_add(&hash, k, 1);
+}
+
+int
+main(void)
+{
+    int t1, t2, i;
+    uint v, want, sum;
+    void *p;
+    struct lf_node *n;
+
+    // one producer thread, main consumes in order
+    spsc_init(&ring, ringslots, NELEM(ringslots));
+    t1 = thread_creator(&spsc_producer, 0);
+    for(want = 1; want <= N; want++){
+        while(spsc_pop(&ring, &p) < 0)
+            atomic_pause();
+        if((uint)p != want)
+            fail("spsc order");
+    }
+    thread_joiner(t1);
+
+    // two producer threads, main consumes everything
+    mpmc_init(&queue, cells, NELEM(cells));
+    t1 = thread_creator(&mpmc_producer, (void *)0);
+    t2 = thread_creator(&mpmc_producer, (void *)N);
+    sum = 0;
+    for(i = 0; i < 2 * N; i++){
+        while(mpmc_pop(&queue, &p) < 0)
+            atomic_pause();
+        sum += (uint)p;
+    }
+    thread_joiner(t1);
+    thread_joiner(t2);
+    if(sum != (uint)(2 * N) * (2 * N + 1) / 2)
+        fail("mpmc sum");
+
+    // two threads and main pop and push back the same nodes
+    lfstack_init(&stack);
+    for(i = 0; i < NNODES; i++)
+        lfstack_push(&stack, &nodes[i]);
+    t1 = thread_creator(&stack_worker, 0);
+    t2 = thread_creator(&stack_worker, 0);
+    stack_worker(0);
+    thread_joiner(t1);
+    thread_joiner(t2);
+    for(i = 0; (n = lfstack_pop(&stack)) != 0; i++){
+        if(n->next == n)
+            fail("stack loop");
+    }
+    if(i != NNODES)
+        fail("stack count");
+
+    // two threads count the same keys
+    lfhash_init(&hash, entries, NELEM(entries));
+    t1 = thread_creator(&hash_worker, 0);
+    t2 = thread_creator(&hash_worker, 0);
+    thread_joiner(t1);
+    thread_joiner(t2);
+    for(v = 1; v <= 500; v++){
+        if(lfhash_get(&hash, v, &want) < 0 || want != 2)
+            fail("hash count");
+    }
+    lfhash_del(&hash, 7);
+    if(lfhash_get(&hash, 7, &want) == 0)
+        fail("hash del");
+
+    printf(1, "lockfree_test: OK\n");
+    exit();
+}
@@ -19,7 +19,9 @@ main(void)
 {
   kinit1(end, P2V(4*1024*1024)); // phys page allocator
   kvmalloc();      // kernel page table
+  slabinit();      // kernel object caches
   mpinit();        // detect other processors
+  acpiinit();      // numa nodes of processors and memory
   lapicinit();     // interrupt controller
   seginit();       // segment descriptors
   picinit();       // disable pic
@@ -28,11 +30,15 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
+  fpuinit();       // floating point and sse
   binit();         // buffer cache
+  pcacheinit();    // page cache
   fileinit();      // file table
+  pipeinit();      // pipe buffers
+  shminit();       // shared memory segments
   ideinit();       // disk 
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(4*1024*1024), P2V(phystop)); // must come after startothers()
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -44,6 +50,7 @@ mpenter(void)
   switchkvm();
   seginit();
   lapicinit();
+  fpuinit();
   mpmain();
 }
 
@@ -0,0 +1,78 @@
+#include "types.h"
+#include "user.h"
+#include "thread.h"
+
+// Stresses malloc/free from several threads at once and checks
+// that a freed large block at the heap top is given back.
+
+#define NTHREADS 4
+#define NSLOTS 64
+#define ROUNDS 5000
+
+int failed;
+
+void
+worker(void *arg)
+{
+    char *slot[NSLOTS];
+    uint size[NSLOTS];
+    uint seed = (uint)arg * 7919 + 1;
+    int i, j, k;
+
+    memset(slot, 0, sizeof(slot));
+    for(i = 0; i < ROUNDS; i++){
+        seed = seed * 1103515245 + 12345;
+        k = (seed >> 8) % NSLOTS;
+        if(slot[k]){
+            // check the pattern written at malloc
+            for(j = 0; j < size[k]; j++)
+                if(slot[k][j] != (char)(k + (int)arg))
+                    failed = 1;
+            free(slot[k]);
+            slot[k] = 0;
+        } else {
+            // mostly small, now and then large
+            size[k] = (seed >> 16) % 8 == 0 ? 5000 + (seed >> 4) % 20000
+                                            : 1 + (seed >> 4) % 600;
+            if((slot[k] = malloc(size[k])) == 0){
+                failed = 1;
+                return;
+            }
+            memset(slot[k], k + (int)arg, size[k]);
+        }
+    }
+    for(k = 0; k < NSLOTS; k++)
+        free(slot[k]);
+}
+
+int
+main(void)
+{
+    int tids[NTHREADS];
+    int i;
+    char *top, *p;
+
+    for(i = 0; i < NTHREADS; i++)
+        tids[i] = thread_creator(&worker, (void *)i);
+    worker((void *)NTHREADS);
+    for(i = 0; i < NTHREADS; i++)
+        thread_joiner(tids[i]);
+    if(failed){
+        printf(1, "malloc_test: corrupted block FAILED\n");
+        exit();
+    }
+
+    top = sbrk(0);
+    p = malloc(1024 * 1024);
+    if(p == 0 || sbrk(0) < top + 1024 * 1024){
+        printf(1, "malloc_test: large malloc FAILED\n");
+        exit();
+    }
+    free(p);
+    if(sbrk(0) > top){
+        printf(1, "malloc_test: heap top not trimmed FAILED\n");
+        exit();
+    }
+    printf(1, "malloc_test: OK\n");
+    exit();
+}
@@ -0,0 +1,24 @@
+// Memory use of a process, as returned by procmem().
+// Sizes are in pages unless noted.
+struct procmem {
+  int pid;
+  char name[16];
+  uint sz;        // size of the heap in bytes
+  uint rss;       // resident pages
+  uint swapped;   // pages out in swap
+  uint ptpages;   // page table pages, the directory included
+  uint minflt;    // faults handled without reading the disk
+  uint majflt;    // faults that read a page in from disk
+};
+
+// Memory use of the machine, as returned by sysmem().
+// Needs param.h, for NNODE.
+struct sysmem {
+  uint total;     // physical pages the kernel manages
+  uint free;
+  uint swaptotal; // pages of swap space
+  uint swapfree;
+  uint nnode;     // NUMA nodes, see setmempolicy()
+  uint nodetotal[NNODE];
+  uint nodefree[NNODE];
+};
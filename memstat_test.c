@@ -0,0 +1,67 @@
+#include "types.h"
+#include "param.h"
+#include "user.h"
+#include "memstat.h"
+
+// Touching memory shows up in the resident size and fault
+// counts of the process and in the machine's free page count;
+// freeing it gives the pages back.
+
+#define PGSIZE 4096
+#define NPG 256
+
+void fail(char *why)
+{
+    printf(1, "memstat_test: %s failed\n", why);
+    exit();
+}
+
+void self(struct procmem *pm)
+{
+    int n;
+
+    for(n = 0; procmem(n, pm) == 0; n++)
+        if(pm->pid == getpid())
+            return;
+    fail("finding self");
+}
+
+int main(void)
+{
+    struct procmem before, after;
+    struct sysmem sm0, sm1;
+    char *p;
+    int i;
+
+    if(sysmem(&sm0) < 0 || sm0.free == 0 || sm0.free > sm0.total)
+        fail("sysmem");
+    self(&before);
+    if(before.rss == 0 || before.ptpages < 2 || before.minflt == 0)
+        fail("initial counts");
+
+    // Untouched sbrk() memory is not resident.
+    if((p = sbrk(NPG * PGSIZE)) == (char *)-1)
+        fail("sbrk");
+    self(&after);
+    if(after.sz != before.sz + NPG * PGSIZE || after.rss > before.rss + 2)
+        fail("reserving");
+
+    for(i = 0; i < NPG; i++)
+        p[i * PGSIZE] = i;
+    self(&after);
+    if(sysmem(&sm1) < 0)
+        fail("sysmem");
+    if(after.rss < before.rss + NPG)
+        fail("resident size");
+    if(after.minflt == before.minflt)
+        fail("fault count");
+    if(sm1.free + NPG > sm0.free)
+        fail("free pages");
+
+    sbrk(-NPG * PGSIZE);
+    self(&after);
+    if(after.rss >= before.rss + NPG)
+        fail("freeing");
+    printf(1, "memstat_test: OK\n");
+    exit();
+}
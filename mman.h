@@ -0,0 +1,15 @@
+// mmap() protection and flags
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+
+#define MAP_SHARED    0x01    // writes reach the file, children share
+#define MAP_PRIVATE   0x02    // writes are private copies
+#define MAP_ANONYMOUS 0x20    // zeroed memory, no file
+
+#define MAP_FAILED    ((void*)-1)
+
+// setmempolicy() modes: where new pages of user memory come from
+#define MPOL_LOCAL      0     // the node of the CPU running the process
+#define MPOL_PREFERRED  1     // the given node, else the nearest one
+#define MPOL_BIND       2     // the given node only
+#define MPOL_INTERLEAVE 3     // each node in turn
@@ -0,0 +1,138 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+
+// Checks private and shared file mappings, msync(), write back
+// on exit, anonymous memory shared with a child, and munmap() of
+// part of a region.
+
+#define PGSIZE 4096
+#define NPG 5
+#define FSIZE (NPG * PGSIZE - 100)   // last page is partial
+
+char buf[PGSIZE];
+
+void fail(char *why)
+{
+    printf(1, "mmap_test: %s failed\n", why);
+    exit();
+}
+
+int expect(int i)
+{
+    return (i * 7 + i / PGSIZE) & 0xff;
+}
+
+void mkfile(char *name)
+{
+    int fd, i, j;
+
+    unlink(name);
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0)
+        fail("create");
+    for(i = 0; i < FSIZE; i += PGSIZE){
+        for(j = 0; j < PGSIZE; j++)
+            buf[j] = expect(i + j);
+        if(write(fd, buf, i + PGSIZE > FSIZE ? FSIZE - i : PGSIZE) < 0)
+            fail("write");
+    }
+    close(fd);
+}
+
+int main(void)
+{
+    char *p, *q;
+    int fd, i, pid;
+
+    mkfile("mmapfile");
+
+    // private: reads the file, writes stay in this process
+    if((fd = open("mmapfile", O_RDONLY)) < 0)
+        fail("open");
+    p = mmap(0, NPG * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(p == MAP_FAILED)
+        fail("mmap private");
+    close(fd);
+    for(i = 0; i < FSIZE; i++)
+        if((uchar)p[i] != expect(i))
+            fail("private read");
+    for(i = FSIZE; i < NPG * PGSIZE; i++)
+        if(p[i] != 0)
+            fail("zero past end of file");
+    p[0] = p[PGSIZE] = 0x55;
+    if((fd = open("mmapfile", O_RDONLY)) < 0 || read(fd, buf, 1) != 1 ||
+       (uchar)buf[0] != expect(0))
+        fail("private write stays private");
+    close(fd);
+
+    // unmapping the middle leaves both ends mapped
+    if(munmap(p + PGSIZE, 2 * PGSIZE) < 0)
+        fail("munmap middle");
+    if(p[0] != 0x55 || (uchar)p[3 * PGSIZE] != expect(3 * PGSIZE))
+        fail("pages around the hole");
+    if(munmap(p, NPG * PGSIZE) < 0)
+        fail("munmap");
+
+    // shared: stores reach the file through msync()
+    if((fd = open("mmapfile", O_RDWR)) < 0)
+        fail("open rw");
+    p = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    q = mmap(0, FSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED || q == MAP_FAILED)
+        fail("mmap shared");
+    p[10] = 'x';
+    p[2 * PGSIZE + 1] = 'y';
+    p[FSIZE - 1] = 'z';
+    if(q[10] != 'x' || q[2 * PGSIZE + 1] != 'y' || q[FSIZE - 1] != 'z')
+        fail("shared mappings see each other");
+    if(msync(p, FSIZE) < 0)
+        fail("msync");
+    if(read(fd, buf, 16) != 16 || buf[10] != 'x')
+        fail("read after msync");
+    // the kernel must not store into read-only pages either
+    if(read(fd, q, 16) != -1 || read(fd, (char*)main, 16) != -1)
+        fail("read into read-only memory");
+    close(fd);
+    if(munmap(p, FSIZE) < 0 || munmap(q, FSIZE) < 0)
+        fail("munmap shared");
+
+    // exit writes shared pages back too
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0){
+        if((fd = open("mmapfile", O_RDWR)) < 0)
+            fail("open rw");
+        p = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(p == MAP_FAILED)
+            fail("mmap shared");
+        p[11] = 'w';
+        exit();
+    }
+    wait();
+    if((fd = open("mmapfile", O_RDONLY)) < 0 || read(fd, buf, 16) != 16 ||
+       buf[11] != 'w')
+        fail("write back on exit");
+    close(fd);
+
+    // anonymous shared memory is shared with children
+    p = mmap(0, 2 * PGSIZE, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED || p[0] != 0)
+        fail("mmap anonymous");
+    p[0] = 1;
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0){
+        p[PGSIZE] = p[0] + 1;
+        exit();
+    }
+    wait();
+    if(p[PGSIZE] != 2)
+        fail("shared with child");
+    munmap(p, 2 * PGSIZE);
+
+    unlink("mmapfile");
+    printf(1, "mmap_test: OK\n");
+    exit();
+}
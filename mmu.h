@@ -6,10 +6,16 @@
 
 // Control Register flags
 #define CR0_PE          0x00000001      // Protection Enable
+#define CR0_MP          0x00000002      // Monitor coProcessor
+#define CR0_EM          0x00000004      // Emulation
+#define CR0_TS          0x00000008      // Task Switched
+#define CR0_NE          0x00000020      // Numeric Error
 #define CR0_WP          0x00010000      // Write Protect
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_OSFXSR      0x00000200      // fxsave/fxrstor and SSE
+#define CR4_OSXMMEXCPT  0x00000400      // SSE exceptions raise #XM
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -83,23 +89,37 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define SPGSIZE         0x400000 // bytes mapped by a superpage (PTE_PS)
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
 
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
+#define SPGROUNDUP(sz)  (((sz)+SPGSIZE-1) & ~(SPGSIZE-1))
+#define SPGROUNDDOWN(a) (((a)) & ~(SPGSIZE-1))
 
 // Page table/directory entry flags.
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_SWAP        0x200   // Not present, swapped out (software)
+#define PTE_SHARED      0x400   // Shared, not copied, by fork (software)
+#define PTE_COW         0x800   // Copy-on-write (available to software)
+#define PTE_HUGE        0x200   // Not present PDE, from sbrkhuge() (software)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
 
+// Page fault error code bits
+#define FEC_PR          0x1     // Page fault caused by protection violation
+#define FEC_WR          0x2     // Page fault caused by a write
+#define FEC_U           0x4     // Page fault occured while in user mode
+
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
 
@@ -144,6 +164,27 @@ struct taskstate {
   ushort iomb;       // I/O map base address
 };
 
+// FPU and SSE registers, as saved by fxsave and loaded by
+// fxrstor, which want them 16-byte aligned.
+struct fxsave {
+  ushort fcw;        // x87 control word
+  ushort fsw;        // x87 status word
+  uchar ftw;         // x87 tag word, abridged: 1 bit per register
+  uchar rsv1;
+  ushort fop;
+  uint fip;
+  ushort fcs;
+  ushort rsv2;
+  uint fdp;
+  ushort fds;
+  ushort rsv3;
+  uint mxcsr;        // SSE control and status
+  uint mxcsrmask;    // mxcsr bits the CPU supports, 0 for 0xFFBF
+  uchar st[8][16];   // x87 registers st0-st7 (or mmx)
+  uchar xmm[8][16];  // xmm0-xmm7
+  uchar rsv4[224];
+} __attribute__((aligned(16)));
+
 // Gate descriptors for interrupts and traps
 struct gatedesc {
   uint off_15_0 : 16;   // low 16 bits of offset in segment
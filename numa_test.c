@@ -0,0 +1,75 @@
+#include "types.h"
+#include "param.h"
+#include "user.h"
+#include "mman.h"
+#include "memstat.h"
+
+// Memory placement policies: pages a process touches come from
+// the node it binds to, or from each node in turn when it
+// interleaves. On a machine with one node (qemu without -numa,
+// see make qemu-numa) only the checks that hold there are made.
+
+#define PGSIZE 4096
+#define NPG 512
+
+void fail(char *why)
+{
+    printf(1, "numa_test: %s failed\n", why);
+    exit();
+}
+
+// Touch npg new pages, and return how many pages each node lost.
+void touch(int npg, int *used)
+{
+    struct sysmem before, after;
+    char *p;
+    int i;
+
+    if(sysmem(&before) < 0 || (p = sbrk(npg * PGSIZE)) == (char *)-1)
+        fail("sbrk");
+    for(i = 0; i < npg; i++)
+        p[i * PGSIZE] = i;
+    if(sysmem(&after) < 0)
+        fail("sysmem");
+    for(i = 0; i < after.nnode; i++)
+        used[i] = before.nodefree[i] - after.nodefree[i];
+}
+
+int main(void)
+{
+    struct sysmem sm;
+    int used[NNODE], n, total;
+
+    if(sysmem(&sm) < 0 || sm.nnode < 1 || sm.nnode > NNODE)
+        fail("sysmem");
+    total = 0;
+    for(n = 0; n < sm.nnode; n++)
+        total += sm.nodetotal[n];
+    if(total != sm.total)
+        fail("node sizes");
+    if(setmempolicy(MPOL_BIND, sm.nnode) == 0 ||
+       setmempolicy(MPOL_PREFERRED, -1) == 0 || setmempolicy(99, 0) == 0)
+        fail("bad policy");
+
+    // Bound to the last node, new pages all come from there.
+    n = sm.nnode - 1;
+    if(setmempolicy(MPOL_BIND, n) < 0)
+        fail("setmempolicy");
+    touch(NPG, used);
+    if(used[n] < NPG)
+        fail("bind");
+    if(n > 0 && used[0] > NPG / 4)
+        fail("bind elsewhere");
+
+    // Interleaved, every node gives some.
+    if(setmempolicy(MPOL_INTERLEAVE, 0) < 0)
+        fail("setmempolicy");
+    touch(NPG, used);
+    for(n = 0; n < sm.nnode; n++)
+        if(used[n] < NPG / sm.nnode / 2)
+            fail("interleave");
+
+    setmempolicy(MPOL_LOCAL, 0);
+    printf(1, "numa_test: OK (%d nodes)\n", sm.nnode);
+    exit();
+}
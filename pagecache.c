@@ -0,0 +1,237 @@
+// Page cache.
+//
+// Keeps whole pages of file contents, so that processes running
+// the same program or mapping the same file (mmap()) map the same
+// physical pages instead of each reading its own copy; see
+// filefill() in vm.c.
+//
+// Interface:
+// * pcacheget() returns the page holding PGSIZE bytes of an inode
+//     at a given offset, with a reference (kref) for the caller,
+//     which drops it with kfree().
+// * writei() calls pcacheupdate() with the bytes it writes, so
+//     cached pages, and the processes mapping them, see the new
+//     contents.
+// * Truncating an inode must call pcacheinval().
+//
+// The cache itself holds one reference to each of its pages. When
+// it needs an entry it recycles the least recently used page that
+// no process maps, so that processes sharing a file through
+// MAP_SHARED keep finding the same page. If every cached page is
+// mapped, a new page is handed out without being cached.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCACHE 1024
+#define NPCHASH 256
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;
+  char *page;             // 0 if the entry is unused
+  struct pcpage *prev;    // LRU list
+  struct pcpage *next;
+  struct pcpage *hnext;   // hash chain, if page is set
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage entry[NPCACHE];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used.
+  struct pcpage head;
+  struct pcpage *hash[NPCHASH];
+} pcache;
+
+static struct pcpage**
+bucket(uint dev, uint inum, uint off)
+{
+  return &pcache.hash[(dev * 31 + inum * 17 + off / PGSIZE) % NPCHASH];
+}
+
+void
+pcacheinit(void)
+{
+  struct pcpage *e;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(e = pcache.entry; e < pcache.entry+NPCACHE; e++){
+    e->next = pcache.head.next;
+    e->prev = &pcache.head;
+    pcache.head.next->prev = e;
+    pcache.head.next = e;
+  }
+}
+
+// Move e to the front of the LRU list. Caller holds pcache.lock.
+static void
+touch(struct pcpage *e)
+{
+  e->next->prev = e->prev;
+  e->prev->next = e->next;
+  e->next = pcache.head.next;
+  e->prev = &pcache.head;
+  pcache.head.next->prev = e;
+  pcache.head.next = e;
+}
+
+// Take e's page out of the cache and return it; the caller
+// drops the cache's reference. Caller holds pcache.lock.
+static char*
+forget(struct pcpage *e)
+{
+  struct pcpage **pp;
+  char *page;
+
+  for(pp = bucket(e->dev, e->inum, e->off); *pp != e; pp = &(*pp)->hnext)
+    ;
+  *pp = e->hnext;
+  page = e->page;
+  e->page = 0;
+  return page;
+}
+
+// Entry for ip's page at off, or 0. Caller holds pcache.lock.
+static struct pcpage*
+find(uint dev, uint inum, uint off)
+{
+  struct pcpage *e;
+
+  for(e = *bucket(dev, inum, off); e; e = e->hnext)
+    if(e->dev == dev && e->inum == inum && e->off == off)
+      return e;
+  return 0;
+}
+
+// Cached page of ip at off, with a reference added for the
+// caller. Caller holds pcache.lock.
+static char*
+lookup(uint dev, uint inum, uint off)
+{
+  struct pcpage *e;
+
+  if((e = find(dev, inum, off)) == 0)
+    return 0;
+  touch(e);
+  kref(e->page);
+  return e->page;
+}
+
+// Return the page holding bytes [off, off+PGSIZE) of ip, reading
+// it if it is not cached, in which case *read is set. Bytes past
+// the end of the file are zero. The caller must not hold ip->lock
+// or a spinlock, and must kfree() the page when done. Returns 0
+// on error.
+char*
+pcacheget(struct inode *ip, uint off, int *read)
+{
+  struct pcpage *e, **b;
+  char *page, *old;
+  int n;
+
+  acquire(&pcache.lock);
+  page = lookup(ip->dev, ip->inum, off);
+  release(&pcache.lock);
+  if(page)
+    return page;
+
+  if((page = kallocswap(0)) == 0)
+    return 0;
+  *read = 1;
+  // Hold ip until the page is in the cache, so that a writei()
+  // cannot slip in between and miss it in pcacheupdate().
+  ilock(ip);
+  if((n = readi(ip, page, off, PGSIZE)) <= 0){
+    iunlock(ip);
+    kfree(page);
+    return 0;
+  }
+  memset(page + n, 0, PGSIZE - n);
+
+  acquire(&pcache.lock);
+  if((old = lookup(ip->dev, ip->inum, off)) != 0){
+    // Someone else read it meanwhile.
+    release(&pcache.lock);
+    iunlock(ip);
+    kfree(page);
+    return old;
+  }
+  // Recycle the least recently used entry no one maps.
+  for(e = pcache.head.prev; e != &pcache.head; e = e->prev)
+    if(e->page == 0 || krefcount(e->page) == 1)
+      break;
+  if(e == &pcache.head){
+    release(&pcache.lock);
+    iunlock(ip);
+    return page;
+  }
+  old = e->page ? forget(e) : 0;
+  e->dev = ip->dev;
+  e->inum = ip->inum;
+  e->off = off;
+  e->page = page;
+  b = bucket(e->dev, e->inum, e->off);
+  e->hnext = *b;
+  *b = e;
+  touch(e);
+  kref(page);
+  release(&pcache.lock);
+  iunlock(ip);
+  if(old)
+    kfree(old);
+  return page;
+}
+
+// Copy the n bytes at src, just written to ip at off, into
+// the cached pages of ip that hold any of them. Pages start at
+// whatever offset the caller of pcacheget() asked for, which for
+// exec() need not be page aligned, so those holding a byte of
+// [off, off+n) start anywhere in (off-PGSIZE, off+n). Each is in
+// the bucket of the page its start falls in.
+void
+pcacheupdate(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcpage *e;
+  uint k, lo, hi;
+
+  if(n == 0)
+    return;
+  acquire(&pcache.lock);
+  k = off < PGSIZE ? 0 : (off - PGSIZE + 1) / PGSIZE;
+  for(; k <= (off + n - 1) / PGSIZE; k++){
+    for(e = *bucket(ip->dev, ip->inum, k * PGSIZE); e; e = e->hnext){
+      if(e->dev != ip->dev || e->inum != ip->inum || e->off / PGSIZE != k)
+        continue;
+      lo = off > e->off ? off : e->off;
+      hi = off + n < e->off + PGSIZE ? off + n : e->off + PGSIZE;
+      if(lo < hi)
+        memmove(e->page + (lo - e->off), src + (lo - off), hi - lo);
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Forget the cached pages of ip. Processes that have them
+// mapped keep their copies.
+void
+pcacheinval(struct inode *ip)
+{
+  struct pcpage *e;
+
+  acquire(&pcache.lock);
+  for(e = pcache.entry; e < pcache.entry+NPCACHE; e++)
+    if(e->page && e->dev == ip->dev && e->inum == ip->inum)
+      kfree(forget(e));
+  release(&pcache.lock);
+}
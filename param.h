@@ -1,15 +1,19 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC        64  // least number of processes allowed
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define NNODE         4  // maximum number of NUMA nodes
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // mapped memory regions per process
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXUSTACK (8*1024*1024)  // most the user stack can grow to
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FSSIZE       2000  // size of file system in blocks
+#define NSWAP       16384  // pages of swap space, on disk after the file system
+#define SWAPBATCH      32  // pages pushed out to swap at a time
+#define DISKSIZE     (FSSIZE + NSWAP*8)  // size of the disk in blocks
 
 #define QUANTUM 10
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+
+// Writes a file while a child maps it and reads it in through
+// the page cache. Once both are done, a new mapping of the file
+// must see what was written, not the page as the child read it.
+
+#define PGSIZE 4096
+#define ROUNDS 50
+#define FILE "pcachefile"
+
+char buf[PGSIZE];
+
+void fail(char *why)
+{
+    printf(1, "pcache_test: %s failed\n", why);
+    exit();
+}
+
+void fill(int fd, int c)
+{
+    memset(buf, c, PGSIZE);
+    if(write(fd, buf, PGSIZE) != PGSIZE)
+        fail("write");
+}
+
+// Map the first page of FILE and return its first byte.
+int peek(void)
+{
+    char *p;
+    int fd, c;
+
+    if((fd = open(FILE, O_RDONLY)) < 0)
+        fail("open");
+    p = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+        fail("mmap");
+    c = p[0];
+    munmap(p, PGSIZE);
+    return c;
+}
+
+int main(void)
+{
+    int i, fd, pid;
+
+    for(i = 0; i < ROUNDS; i++){
+        // A new file each round, so the child's read misses.
+        unlink(FILE);
+        if((fd = open(FILE, O_CREATE | O_RDWR)) < 0)
+            fail("create");
+        fill(fd, 'a');
+        close(fd);
+        if((pid = fork()) < 0)
+            fail("fork");
+        if(pid == 0){
+            peek();
+            exit();
+        }
+        if((fd = open(FILE, O_RDWR)) < 0)
+            fail("open rw");
+        fill(fd, 'b');
+        close(fd);
+        wait();
+        if(peek() != 'b')
+            fail("stale cached page");
+    }
+    unlink(FILE);
+    printf(1, "pcache_test: OK\n");
+    exit();
+}
@@ -0,0 +1,68 @@
+#include "types.h"
+#include "user.h"
+#include "taskpool.h"
+
+// Scaling benchmark for the task pool.
+// Runs the same parallel_for with 1..ncpu workers and prints the
+// speedup over one worker. Boot with e.g. make CPUS=4 qemu.
+// usage: pool_bench [rounds]
+
+#define N 2048
+
+int out[N];
+int rounds = 20000;
+
+static int
+work(int i)
+{
+    int k;
+    uint x = i;
+
+    for(k = 0; k < rounds; k++)
+        x = x * 1103515245 + 12345;
+    return x;
+}
+
+static void
+body(int lo, int hi, void *arg)
+{
+    int i;
+
+    for(i = lo; i < hi; i++)
+        out[i] = work(i);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int n, i, ncpu, t, base = 0;
+
+    if(argc > 1)
+        rounds = atoi(argv[1]);
+    ncpu = getncpu();
+    printf(1, "pool_bench: %d cpus, %d items x %d rounds\n", ncpu, N, rounds);
+    for(n = 1; n <= ncpu; n++){
+        if(pool_start(n) != n){
+            printf(1, "pool_bench: pool_start(%d) failed\n", n);
+            exit();
+        }
+        memset(out, 0, sizeof(out));
+        t = uptime();
+        pool_parallel_for(0, N, 8, &body, 0);
+        t = uptime() - t;
+        pool_stop();
+        for(i = 0; i < N; i++){
+            if(out[i] != work(i)){
+                printf(1, "pool_bench: wrong result at %d\n", i);
+                exit();
+            }
+        }
+        if(t == 0)
+            t = 1;
+        if(n == 1)
+            base = t;
+        printf(1, "workers %d: %d ticks, speedup %d.%d%d\n", n, t,
+               base / t, (base * 10 / t) % 10, (base * 100 / t) % 10);
+    }
+    exit();
+}
@@ -6,17 +6,27 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "memstat.h"
+#include "mman.h"
 
+#define NPIDHASH NPROC
+#define PROCPAGES 128   // physical pages per process allowed
+
+// The process table grows on demand: allocproc() takes a new
+// struct proc from the slab cache when no entry is UNUSED, up to
+// maxproc, which scales with physical memory. Entries are never
+// freed, so a struct proc pointer stays valid.
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct proc *procs;           // every entry, linked by pnext
+  struct proc **ptail;
+  int nproc;
+  int maxproc;
+  struct kmem_cache *cache;
+  struct proc *pidhash[NPIDHASH];
 } ptable;
 
-struct ticket {
-  struct proc *proc;
-  uint tickets;
-};
-
 unsigned int g_seed = 0;
 
 // Used to seed the generator.           
@@ -33,11 +43,17 @@ int rand(void) {
 
 static struct proc *initproc;
 
+// One reclaim() at a time: it owns the queue of pages
+// being written to swap until swapflush() empties it.
+static struct sleeplock reclaimlock;
+
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void pidunhash(struct proc *p);
+static int reapthread(struct proc *p);
 
 /*
 * Scheduler Type
@@ -63,6 +79,9 @@ void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  ptable.ptail = &ptable.procs;
+  ptable.cache = kmem_cache_create("proc", sizeof(struct proc), 0);
+  initsleeplock(&reclaimlock, "reclaim");
 }
 
 // Must be called with interrupts disabled
@@ -117,12 +136,19 @@ allocproc(void)
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for(p = ptable.procs; p; p = p->pnext)
     if(p->state == UNUSED)
       goto found;
 
-  release(&ptable.lock);
-  return 0;
+  if(ptable.nproc >= ptable.maxproc ||
+     (p = kmem_cache_alloc(ptable.cache)) == 0){
+    release(&ptable.lock);
+    return 0;
+  }
+  memset(p, 0, sizeof(*p));
+  *ptable.ptail = p;
+  ptable.ptail = &p->pnext;
+  ptable.nproc++;
 
 found:
   p->state = EMBRYO;
@@ -136,12 +162,28 @@ found:
   p->ru_t = 0;        //initialize running time
   p->re_t = 0;        //initialize ready time
   p->st = 0;          //initialize sleeping time
+  p->nthreads = 0;    //no threads created yet
+  p->tdone = 0;
+  p->tzombies = 0;
+  p->tnext = 0;
+  p->vmowner = p;
+  p->growlocked = 0;
+  p->pinlo = p->pinhi = 0;
+  p->minflt = p->majflt = 0;
+  p->mpol = MPOL_LOCAL;
+  p->mpolnode = 0;
+  fpuload(p, 0);
+  p->hnext = ptable.pidhash[p->pid % NPIDHASH];
+  ptable.pidhash[p->pid % NPIDHASH] = p;
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
+    acquire(&ptable.lock);
+    pidunhash(p);
     p->state = UNUSED;
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -171,6 +213,9 @@ userinit(void)
   struct proc *p;
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
+  ptable.maxproc = kpages() / PROCPAGES;
+  if(ptable.maxproc < NPROC)
+    ptable.maxproc = NPROC;
   p = allocproc();
   
   initproc = p;
@@ -201,25 +246,73 @@ userinit(void)
   release(&ptable.lock);
 }
 
-// Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Grow current process's memory by n bytes. If align is
+// not 0, the new memory starts at a multiple of align and
+// is a multiple of it long.
+// Return where the new memory starts on success (the old
+// size if n <= 0), -1 on failure.
 int
-growproc(int n)
+growproc(int n, uint align)
 {
-  uint sz;
+  uint sz, oldsz, len;
   struct proc *curproc = myproc();
 
-  sz = curproc->sz;
+  growlock(curproc);
+  sz = oldsz = curproc->vmowner->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the space, pgfault() fills in
+    // zeroed pages as they are first touched.
+    len = n;
+    if(align){
+      oldsz = (sz + align - 1) / align * align;
+      len = (len + align - 1) / align * align;
+    }
+    if(oldsz < sz || oldsz + len < oldsz || oldsz + len >= KERNBASE ||
+       !vmafree(curproc, sz, oldsz + len)){
+      growunlock(curproc);
       return -1;
+    }
+    sz = oldsz + len;
+    if(align == SPGSIZE)
+      hugeuvm(curproc->pgdir, oldsz, sz);
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Also drops the freed pages from the TLB.
+    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      growunlock(curproc);
       return -1;
+    }
   }
-  curproc->sz = sz;
-  switchuvm(curproc);
-  return 0;
+  // Threads read the size from the owner of the address space.
+  curproc->vmowner->sz = sz;
+  growunlock(curproc);
+  return oldsz;
+}
+
+// Lock the address space of p, shared with its threads: its
+// page table, regions and size, see vmowner. Sleeps, so the
+// caller must hold no spinlock. Holding the ptable lock while
+// the address space is not locked keeps it from changing too,
+// which is how reclaim() and procmem() look at other processes'
+// memory.
+void
+growlock(struct proc *p)
+{
+  p = p->vmowner;
+  acquire(&ptable.lock);
+  while(p->growlocked)
+    sleep(&p->growlocked, &ptable.lock);
+  p->growlocked = 1;
+  release(&ptable.lock);
+}
+
+void
+growunlock(struct proc *p)
+{
+  p = p->vmowner;
+  acquire(&ptable.lock);
+  p->growlocked = 0;
+  wakeup1(&p->growlocked);
+  release(&ptable.lock);
 }
 
 // Create a new process copying p as the parent.
@@ -237,17 +330,28 @@ fork(void)
     return -1;
   }
 
-  // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  // Copy process state from proc. mmap() regions lie
+  // above sz, so copy all of user space.
+  while((np->pgdir = copyuvm(curproc->pgdir, KERNBASE)) == 0 &&
+        reclaim(SWAPBATCH) > 0)
+    ;
+  if(np->pgdir == 0){
     kfree(np->kstack);
     np->kstack = 0;
+    acquire(&ptable.lock);
+    pidunhash(np);
     np->state = UNUSED;
+    release(&ptable.lock);
     return -1;
   }
-  np->sz = curproc->sz;
+  np->sz = curproc->vmowner->sz;
   np->parent = curproc;
   *np->tf = *curproc->tf;
+  fpusave(curproc);
+  np->fpu = curproc->fpu;
   np->priority = curproc->priority;
+  np->mpol = curproc->mpol;
+  np->mpolnode = curproc->mpolnode;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
@@ -256,6 +360,7 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  vmadup(np, curproc);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -270,6 +375,67 @@ fork(void)
   return pid;
 }
 
+// Create a process running the program at path with arguments
+// argv, as fork() and then exec() in the child would, without
+// first copying the parent's memory only to throw it away.
+// The child's file descriptor i is a duplicate of the parent's
+// fd[i] for i < nfd, or closed if fd[i] is -1, and the rest
+// are closed; if fd is 0 it inherits all of them, as with
+// fork(). Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fd, int nfd)
+{
+  int i, pid;
+  struct file *f;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if(fd && (nfd < 0 || nfd > NOFILE))
+    return -1;
+  for(i = 0; fd && i < nfd; i++)
+    if(fd[i] != -1 &&
+       (fd[i] < 0 || fd[i] >= NOFILE || curproc->ofile[fd[i]] == 0))
+      return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  np->pgdir = 0;
+  *np->tf = *curproc->tf;
+  np->mpol = curproc->mpol;
+  np->mpolnode = curproc->mpolnode;
+  if(execproc(np, path, argv) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    acquire(&ptable.lock);
+    pidunhash(np);
+    np->state = UNUSED;
+    release(&ptable.lock);
+    return -1;
+  }
+  np->parent = curproc;
+  np->priority = curproc->priority;
+
+  for(i = 0; i < NOFILE; i++){
+    if(fd == 0)
+      f = curproc->ofile[i];
+    else
+      f = i < nfd && fd[i] != -1 ? curproc->ofile[fd[i]] : 0;
+    if(f)
+      np->ofile[i] = filedup(f);
+  }
+  np->cwd = idup(curproc->cwd);
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  np->state = RUNNABLE;
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -292,24 +458,44 @@ exit(void)
     }
   }
 
+  vmasyncall(curproc);
   begin_op();
   iput(curproc->cwd);
+  vmaput(curproc);
   end_op();
   curproc->cwd = 0;
 
   acquire(&ptable.lock);
 
+  // A thread signals its own completion for thread_join() and
+  // queues itself on its creator's list for thread_join_any().
+  if(curproc->tcount == -1){
+    curproc->tdone = 1;
+    curproc->tnext = curproc->parent->tzombies;
+    curproc->parent->tzombies = curproc;
+    wakeup1(&curproc->tdone);
+    wakeup1(&curproc->parent->tzombies);
+  }
+
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.procs; p; p = p->pnext){
     if(p->parent == curproc){
       p->parent = initproc;
+      if(p->tcount == -1)
+        initproc->nthreads++;
       if(p->state == ZOMBIE)
         wakeup1(initproc);
     }
   }
+  // Exited threads not yet joined now wait on init's list.
+  while((p = curproc->tzombies) != 0){
+    curproc->tzombies = p->tnext;
+    p->tnext = initproc->tzombies;
+    initproc->tzombies = p;
+  }
 
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
@@ -331,13 +517,20 @@ wait(void)
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    for(p = ptable.procs; p; p = p->pnext){
       if(p->parent != curproc)
         continue;
       havekids = 1;
+      if(p->state == ZOMBIE && p->tcount == -1){
+        // Threads share their creator's pgdir.
+        pid = reapthread(p);
+        release(&ptable.lock);
+        return pid;
+      }
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
+        pidunhash(p);
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
@@ -375,6 +568,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
   
   for(;;){
@@ -382,8 +576,9 @@ scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    for(p = ptable.procs; p; p = p->pnext){
       if(schedtype == 0 || schedtype == 1) // Round Robin
       {
         if(p->state != RUNNABLE)
@@ -397,6 +592,7 @@ scheduler(void)
         p->state = RUNNING;
 
         swtch(&(c->scheduler), p->context);
+        ran = 1;
         // Process comes back to scheduler from here
         switchkvm();
 
@@ -406,10 +602,10 @@ scheduler(void)
       }
       else if (schedtype == 2) // Priority
       {
-        struct proc *lowest = ptable.proc;
+        struct proc *lowest = ptable.procs;
         struct proc *p1;
         //find process with lowest priority
-        for(p1 = ptable.proc; p1 < &ptable.proc[NPROC]; p1++)
+        for(p1 = ptable.procs; p1; p1 = p1->pnext)
         {
           if (p1->state != RUNNABLE)
             continue;
@@ -423,6 +619,7 @@ scheduler(void)
         switchuvm(lowest);
         lowest->state = RUNNING;
         swtch(&(c->scheduler), lowest->context);
+        ran = 1;
         switchkvm();
         c->proc = 0;
       }
@@ -432,7 +629,7 @@ scheduler(void)
         int lowest = 6;
         struct proc *p1;
         //find runnable process with lowest priority
-        for(p1 = ptable.proc; p1 < &ptable.proc[NPROC]; p1++)
+        for(p1 = ptable.procs; p1; p1 = p1->pnext)
         {
           if (p1->state != RUNNABLE)
             continue;
@@ -440,7 +637,7 @@ scheduler(void)
             lowest = p1->priority;
         }
         // do a loop on all processes round robin style, scheduling that priority queue
-        for(p1 = ptable.proc; p1 < &ptable.proc[NPROC]; p1++)
+        for(p1 = ptable.procs; p1; p1 = p1->pnext)
         {
           if(schedtype != 3)
             break;
@@ -450,64 +647,49 @@ scheduler(void)
           switchuvm(p1);
           p1->state = RUNNING;
           swtch(&(c->scheduler), p1->context);
+          ran = 1;
           switchkvm();
           c->proc = 0;
         }
       }
       else if (schedtype == 4) // Lottery Scheduling
       {
-        struct ticket active_tickets[NPROC];
         uint ticket_count = 0;
-        uint active_count = 0;
+        uint passed = 0; //number of tickets that we've "passed" in the loop
+        uint winner;
         struct proc *p1;
-        // find total tickets of active processes
+        // find total tickets of runnable processes
         // each process has 'priority' tickets
-        for(p1 = ptable.proc; p1 < &ptable.proc[NPROC]; p1++)
+        for(p1 = ptable.procs; p1; p1 = p1->pnext)
+          if (p1->state == RUNNABLE)
+            ticket_count += p1->priority;
+        if (ticket_count == 0)
+          continue;
+        winner = rand() % ticket_count;
+        //find which process the ticket belongs to
+        for(p1 = ptable.procs; p1; p1 = p1->pnext)
         {
           if (p1->state != RUNNABLE)
             continue;
-          active_tickets[active_count].proc = p1;
-          active_tickets[active_count].tickets = p1->priority;
-          active_count += 1;
-          ticket_count += p1->priority;
-        }
-        // main scheduler loop
-        while(ticket_count > 0)
-        {
-          int random = rand() % ticket_count;
-          //cprintf("%d", random);
-          //find which process the ticket belongs to
-          int i;
-          int passed = 0; //number of tickets that we've "passed" in the loop
-          for(i = 0; i < active_count; i++)
-          {
-            if((passed + active_tickets[i].tickets) >= random)
-            {
-              //found
-              break;
-            }
-            else
-            {
-              passed += active_tickets[i].tickets;
-            }
-          }
-          struct proc *p_selected = active_tickets[i].proc;
-          //cprintf("\n%d %d %s\n", p_selected->kstack, p_selected->pid, p_selected->name);
-          // remove a ticket from selected process
-          ticket_count -= 1;
-          active_tickets[i].tickets -= 1;
-          // run selected processs
-          c->proc = p_selected;
-          switchuvm(p_selected);
-          p_selected->state = RUNNING;
-          swtch(&(c->scheduler), p_selected->context);
-          switchkvm();
-          c->proc = 0;
+          passed += p1->priority;
+          if (passed > winner)
+            break;
         }
+        // run selected process
+        c->proc = p1;
+        switchuvm(p1);
+        p1->state = RUNNING;
+        swtch(&(c->scheduler), p1->context);
+        ran = 1;
+        switchkvm();
+        c->proc = 0;
       }
     }
     release(&ptable.lock);
 
+    // Nothing to run, get pages ready for kzalloc().
+    if(!ran)
+      kzeroidle();
   }
 }
 
@@ -533,6 +715,7 @@ sched(void)
   if(readeflags()&FL_IF)
     panic("sched interruptible");
   intena = mycpu()->intena;
+  fpusave(p);
   swtch(&p->context, mycpu()->scheduler);
   mycpu()->intena = intena;
 }
@@ -563,6 +746,7 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -615,7 +799,7 @@ wakeup1(void *chan)
 {
   struct proc *p;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for(p = ptable.procs; p; p = p->pnext)
     if(p->state == SLEEPING && p->chan == chan)
       p->state = RUNNABLE;
 }
@@ -629,6 +813,159 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Find the process with the given pid through the pid hash.
+// The ptable lock must be held.
+static struct proc*
+pidlookup(int pid)
+{
+  struct proc *p;
+
+  if(pid <= 0)
+    return 0;
+  for(p = ptable.pidhash[pid % NPIDHASH]; p; p = p->hnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Remove p from the pid hash before its slot is reused.
+// The ptable lock must be held.
+static void
+pidunhash(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->hnext){
+    if(*pp == p){
+      *pp = p->hnext;
+      break;
+    }
+  }
+  p->hnext = 0;
+}
+
+//PAGEBREAK!
+// Page reclaim.
+
+// Clock hand of reclaim(): the process whose address space
+// it is in, and where.
+static struct {
+  int pid;
+  uint va;
+} hand;
+
+// Return 1 if a system call is using page va of pgdir, see
+// prefault(). The ptable lock must be held.
+int
+pinned(pde_t *pgdir, uint va)
+{
+  struct proc *p;
+
+  for(p = ptable.procs; p; p = p->pnext)
+    if(p->pgdir == pgdir && p->state != UNUSED &&
+       va + PGSIZE > p->pinlo && va < p->pinhi)
+      return 1;
+  return 0;
+}
+
+// Return 1 if reclaim() may take pages from p: p owns its
+// address space, which is not being changed, and no other
+// CPU is using it, so that no stale TLB entry can outlive a
+// page. The ptable lock must be held.
+static int
+swappable(struct proc *p)
+{
+  struct proc *q;
+
+  if(p->vmowner != p || p->pgdir == 0 || p->growlocked ||
+     (p->state != RUNNABLE && p->state != SLEEPING && p->state != RUNNING))
+    return 0;
+  for(q = ptable.procs; q; q = q->pnext)
+    if(q->pgdir == p->pgdir && q->state == RUNNING && q != myproc())
+      return 0;
+  return 1;
+}
+
+// Free up to n pages by pushing user pages out to swap. The
+// hand sweeps the address spaces of the processes in turn, and
+// swapscan() takes the pages that were not used since it last
+// passed. Gives up after going around twice, which clears and
+// then tests every accessed bit. Returns the number of pages
+// freed, 0 if none could be. Sleeps, so the caller must hold
+// no spinlock, nor growlock().
+int
+reclaim(int n)
+{
+  struct proc *p;
+  int got, nproc, visits;
+
+  acquiresleep(&reclaimlock);
+  acquire(&ptable.lock);
+  nproc = 0;
+  for(p = ptable.procs; p; p = p->pnext)
+    nproc++;
+  if((p = pidlookup(hand.pid)) == 0){
+    p = ptable.procs;
+    hand.va = 0;
+  }
+  got = 0;
+  for(visits = 0; got < n && visits <= 2*nproc; visits++){
+    if(swappable(p)){
+      got += swapscan(p->pgdir, &hand.va, n - got);
+      if(hand.va < KERNBASE)
+        break;  // got enough, or swap is full
+    }
+    p = p->pnext ? p->pnext : ptable.procs;
+    hand.va = 0;
+  }
+  hand.pid = p->pid;
+  release(&ptable.lock);
+  got = swapflush();
+  releasesleep(&reclaimlock);
+  return got;
+}
+
+// Report the memory use of the n'th process in the table,
+// counting from 0. Threads report the address space they
+// share. Returns -1 if there are not that many processes.
+int
+procmem(int n, struct procmem *pm)
+{
+  struct procmem m;
+  struct proc *p;
+  int i;
+
+  // The ptable lock keeps the page table from being freed
+  // under uvmstat(), and, once no one holds growlock() on
+  // it, from being changed.
+  acquire(&ptable.lock);
+  i = n;
+again:
+  for(p = ptable.procs; p; p = p->pnext)
+    if(p->state != UNUSED && p->state != EMBRYO && i-- == 0)
+      break;
+  if(p == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  if(p->vmowner->growlocked){
+    sleep(&p->vmowner->growlocked, &ptable.lock);
+    i = n;
+    goto again;
+  }
+  memset(&m, 0, sizeof(m));
+  m.pid = p->pid;
+  safestrcpy(m.name, p->name, sizeof(m.name));
+  m.sz = p->vmowner->sz;
+  m.minflt = p->minflt;
+  m.majflt = p->majflt;
+  if(p->pgdir)
+    uvmstat(p->pgdir, &m.rss, &m.swapped, &m.ptpages);
+  release(&ptable.lock);
+  *pm = m;
+  return 0;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -638,15 +975,13 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = pidlookup(pid)) != 0){
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    if(p->state == SLEEPING)
+      p->state = RUNNABLE;
+    release(&ptable.lock);
+    return 0;
   }
   release(&ptable.lock);
   return -1;
@@ -672,7 +1007,7 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.procs; p; p = p->pnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -714,7 +1049,7 @@ int
 getProcInfo(void){
   cprintf("PID -> CTIME\n");
   struct proc *p;
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.procs; p; p = p->pnext){
     if(p->state == RUNNING){
       cprintf("%d -> %d\n", p->pid, p->ctime);
     }else{
@@ -736,6 +1071,10 @@ thread_create(void *stack){
   struct proc *np;
   struct proc *curproc = myproc();
 
+  // The stack in use is copied to the new one, which is a page.
+  if(curproc->tstack - curproc->tf->esp > PGSIZE)
+    return -1;
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
@@ -743,10 +1082,10 @@ thread_create(void *stack){
   np->tstack = (int)((char *)stack + PGSIZE);
   np->tcount = -1; //np is a thread so -1
   curproc->tcount++; //add one thread to curproc thread count
+  curproc->nthreads++;
 
   acquire(&ptable.lock);
   np->pgdir = curproc->pgdir;
-  np->sz = curproc->sz;
   release(&ptable.lock);
   *np->tf = *curproc->tf; //this goddamn line.
   int stack_size = curproc->tstack - curproc->tf->esp;
@@ -766,6 +1105,11 @@ thread_create(void *stack){
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  np->vmowner = curproc->vmowner;
+  fpusave(curproc);
+  np->fpu = curproc->fpu;
+  np->mpol = curproc->mpol;
+  np->mpolnode = curproc->mpolnode;
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
   pid = np->pid;
   acquire(&ptable.lock);
@@ -782,42 +1126,88 @@ thread_id(void){
   return curproc->pid;
 }
 
+// Free a zombie thread's slot and return its tid. The page
+// table belongs to the creator, so it is not freed here.
+// The ptable lock must be held.
+static int
+reapthread(struct proc *p)
+{
+  struct proc **pp;
+  int tid;
+
+  if(p->parent){
+    for(pp = &p->parent->tzombies; *pp; pp = &(*pp)->tnext){
+      if(*pp == p){
+        *pp = p->tnext;
+        break;
+      }
+    }
+    p->parent->nthreads--;
+  }
+  tid = p->pid;
+  pidunhash(p);
+  kfree(p->kstack);
+  p->kstack = 0;
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->pgdir = 0;
+  p->tdone = 0;
+  p->tnext = 0;
+  p->state = UNUSED;
+  return tid;
+}
+
+// Wait for thread tid to exit. Sleeps only on the thread's own
+// completion, so other exits do not wake the joiner.
 int
 thread_join(uint tid){
   struct proc *p;
-  int tid_found = 0;
   struct proc *curproc = myproc();
+
   acquire(&ptable.lock);
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if (p->pid == tid){
-      tid_found = 1;
-      break;
+  p = pidlookup(tid);
+  if(p == 0 || p->tcount != -1){ //no such thread
+    release(&ptable.lock);
+    return -1;
+  }
+  while(p->pid == tid && !p->tdone){
+    if(curproc->killed){
+      release(&ptable.lock);
+      return -1;
     }
+    sleep(&p->tdone, &ptable.lock);
   }
-  release(&ptable.lock);
-  if (!tid_found){
+  if(p->pid != tid){ //reaped by someone else while we slept
+    release(&ptable.lock);
     return -1;
   }
-  if (p->tcount != -1) //if isn't thread
-    return -1; //don't wait
+  reapthread(p);
+  release(&ptable.lock);
+  return 0;
+}
+
+// Wait for any thread created by the caller to exit and
+// return its tid. Return -1 if the caller has no threads.
+int
+thread_join_any(void){
+  struct proc *p;
+  int tid;
+  struct proc *curproc = myproc();
+
   acquire(&ptable.lock);
   for(;;){
-    if(p->state == ZOMBIE){
-      // Found zombie child thread with same pid == tid
-      kfree(p->kstack);
-      p->kstack = 0;
-      //removed a freeuvm function here as we don't remove the page table for threads
-      p->pid = 0;
-      p->parent = 0;
-      p->name[0] = 0;
-      p->killed = 0;
-      p->pgdir = 0;
-      p->state = UNUSED;
+    if((p = curproc->tzombies) != 0){
+      tid = reapthread(p);
       release(&ptable.lock);
-      return 0;
+      return tid;
     }
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-    sleep(curproc, &ptable.lock);  //DOC: wait-sleep
+    if(curproc->nthreads <= 0 || curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(&curproc->tzombies, &ptable.lock);
   }
 }
 
@@ -840,7 +1230,7 @@ int
 update_proc_timing(void){
   struct proc *p;
   acquire(&ptable.lock);
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for (p = ptable.procs; p; p = p->pnext){
     if(p->state == RUNNABLE){
       p->re_t++;    // increasing ready time
     }else if (p->state == RUNNING)
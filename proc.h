@@ -8,6 +8,10 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  int node;                    // NUMA node, see acpi.c
+  struct proc *fpuproc;        // Whose FPU state the registers hold
+  pde_t *pgdir;                // Page table loaded, see flushpages()
+  volatile int tlbpending;     // Shootdown to do, see tlbpoll()
 };
 
 extern struct cpu cpus[NCPU];
@@ -32,11 +36,28 @@ struct context {
   uint eip;
 };
 
+// A region of user memory mapped from a file, or anonymous
+// memory, by exec() or mmap(). Pages are filled in when first
+// touched, see pgfault().
+struct vma {
+  uint start;                  // page aligned
+  uint end;                    // 0 if the slot is free
+  uint off;                    // file offset of start
+  uint filesz;                 // bytes from the file, the rest is zero
+  int writable;
+  int shared;                  // MAP_SHARED: writes reach the file
+                               // and are shared with children
+  struct inode *ip;            // 0 if anonymous
+  struct shm *shm;             // attached segment, see shmat()
+  int stack;                   // the user stack, see execproc()
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
-  uint sz;                     // Size of process memory (bytes)
+  uint sz;                     // Size of process memory (bytes),
+                               // see vmowner
   pde_t* pgdir;                // Page table
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
@@ -59,10 +80,31 @@ struct proc {
   uint ru_t;                   // running time
   uint re_t;                   // ready time
   uint st;                     // sleeping time
+  int nthreads;                // live threads created by this process
+  int tdone;                   // thread completion, set by exit()
+  struct proc *tzombies;       // exited threads waiting to be joined
+  struct proc *tnext;          // next exited thread in parent's tzombies
+  struct proc *hnext;          // next process in pid hash chain
+  struct proc *pnext;          // next entry in the process table
+  struct vma vma[NVMA];        // mapped memory
+  struct proc *vmowner;        // whose vma[], sz and growlocked apply:
+                               // threads use their creator's, as its
+                               // page table
+  int growlocked;              // address space locked, see growlock()
+  uint pinlo, pinhi;           // user memory the current system call
+                               // uses, see prefault()
+  uint minflt;                 // page faults handled without I/O
+  uint majflt;                 // page faults that read from disk
+  int mpol;                    // memory placement, see setmempolicy()
+  int mpolnode;                // node for MPOL_PREFERRED and MPOL_BIND
+  uint mpolnext;               // next node for MPOL_INTERLEAVE
+  struct fxsave fpu;           // FPU and SSE registers, see fpu.c
+  struct cpu *fpucpu;          // CPU whose registers hold them too
 };
 
-// Process memory is laid out contiguously, low addresses first:
+// Process memory is laid out low addresses first:
 //   text
 //   original data and bss
-//   fixed-size stack
-//   expandable heap
+//   expandable heap, up to sz
+//   regions from mmap() and shmat(), placed downwards
+//   the user stack, growing down from KERNBASE
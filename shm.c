@@ -0,0 +1,133 @@
+// Named shared memory segments.
+//
+// A segment is a set of zeroed pages that any process can
+// attach by name with shmat(); every process that attaches it
+// maps the same physical pages, so data put there is seen by
+// the others without copying. Each attachment holds a reference
+// to the segment, and each mapping of a page a reference (kref)
+// to the page, so a segment goes away when the last process
+// detaches it or exits.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define NSHM      16           // segments in the system
+#define SHMNAME   16           // longest name, with the 0
+#define SHMMAXPG  NPTENTRIES   // pages in a segment, 4 MB
+
+struct shm {
+  char name[SHMNAME];
+  int ref;                     // attachments, 0 if the slot is free
+  uint npages;
+  char **pages;                // a page of page pointers
+};
+
+static struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Free the pages of s, which no one attaches any more.
+static void
+shmfree(struct shm *s)
+{
+  uint i;
+
+  for(i = 0; i < s->npages; i++)
+    kfree(s->pages[i]);
+  kfree((char*)s->pages);
+  s->pages = 0;
+  s->npages = 0;
+}
+
+// Return the segment called name with a reference added,
+// creating it with size bytes if there is none. Size 0 finds
+// an existing segment of any size. Returns 0 if it cannot be
+// created, or exists with a different size.
+struct shm*
+shmget(char *name, uint size)
+{
+  struct shm *s, *unused;
+  uint i;
+
+  if(size > SHMMAXPG * PGSIZE)
+    return 0;
+  size = PGROUNDUP(size);
+  acquire(&shmtab.lock);
+  unused = 0;
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++){
+    if(s->ref == 0){
+      if(unused == 0)
+        unused = s;
+      continue;
+    }
+    if(strncmp(s->name, name, SHMNAME) == 0){
+      if(size && s->npages != size / PGSIZE)
+        s = 0;
+      else
+        s->ref++;
+      release(&shmtab.lock);
+      return s;
+    }
+  }
+  if(size == 0 || (s = unused) == 0 || (s->pages = (char**)kalloc()) == 0){
+    release(&shmtab.lock);
+    return 0;
+  }
+  for(i = 0; i < size / PGSIZE; i++){
+    if((s->pages[i] = kzalloc()) == 0){
+      s->npages = i;
+      shmfree(s);
+      release(&shmtab.lock);
+      return 0;
+    }
+  }
+  s->npages = i;
+  safestrcpy(s->name, name, SHMNAME);
+  s->ref = 1;
+  release(&shmtab.lock);
+  return s;
+}
+
+// Add a reference to s, for a process that inherits
+// an attachment through fork().
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Drop a reference to s. Pages still mapped somewhere stay
+// until they are unmapped.
+void
+shmput(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  if(--s->ref == 0)
+    shmfree(s);
+  release(&shmtab.lock);
+}
+
+// Size of s in pages, and its pages.
+uint
+shmsize(struct shm *s)
+{
+  return s->npages;
+}
+
+char*
+shmpage(struct shm *s, uint i)
+{
+  return s->pages[i];
+}
@@ -0,0 +1,80 @@
+#include "types.h"
+#include "user.h"
+
+// A producer and a consumer exchange buffers through a named
+// shared memory segment, then check that the segment goes away
+// once both have detached it.
+
+#define SIZE (64 * 1024)
+#define ROUNDS 50
+
+struct ring {
+    volatile int seq;        // buffers produced
+    volatile int ack;        // buffers consumed
+    int data[(SIZE - 8) / 4];
+};
+
+#define NDATA ((int)(sizeof(((struct ring *)0)->data) / 4))
+
+void fail(char *why)
+{
+    printf(1, "shm_test: %s failed\n", why);
+    exit();
+}
+
+void consumer(void)
+{
+    struct ring *r;
+    int n, i;
+
+    if((r = shmat("shm_test", 0)) == (void *)-1)
+        fail("consumer shmat");
+    for(n = 1; n <= ROUNDS; n++){
+        while(r->seq < n)
+            sleep(0);
+        for(i = 0; i < NDATA; i += 97)
+            if(r->data[i] != n * i)
+                fail("consumer data");
+        r->ack = n;
+    }
+    shmdt(r);
+    exit();
+}
+
+int main(void)
+{
+    struct ring *r, *r2;
+    int n, i;
+
+    if((r = shmat("shm_test", SIZE)) == (void *)-1)
+        fail("shmat");
+    if(r->seq != 0 || r->data[NDATA - 1] != 0)
+        fail("zeroed");
+    if(fork() == 0)
+        consumer();
+    for(n = 1; n <= ROUNDS; n++){
+        for(i = 0; i < NDATA; i += 97)
+            r->data[i] = n * i;
+        r->seq = n;
+        while(r->ack < n)
+            sleep(0);
+    }
+    wait();
+
+    // A second attachment maps the same pages.
+    if((r2 = shmat("shm_test", SIZE)) == (void *)-1 || r2 == r)
+        fail("second shmat");
+    if(r2->seq != ROUNDS)
+        fail("same pages");
+    if(shmat("shm_test", 2 * SIZE) != (void *)-1)
+        fail("size mismatch");
+    if(shmdt(r2) < 0 || shmdt(r) < 0 || shmdt(r) == 0)
+        fail("shmdt");
+
+    // Everyone detached: a new segment starts out zeroed.
+    if((r = shmat("shm_test", SIZE)) == (void *)-1 || r->seq != 0)
+        fail("recreate");
+    shmdt(r);
+    printf(1, "shm_test: OK\n");
+    exit();
+}
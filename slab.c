@@ -0,0 +1,258 @@
+// Slab allocator for kernel objects, after Bonwick,
+// "The Slab Allocator: An Object-Caching Kernel Memory
+// Allocator", USENIX Summer 1994.
+//
+// A cache hands out objects of one size. It carves pages from
+// kalloc() into slabs; the struct slab header sits at the start
+// of its page, so the slab of any object is PGROUNDDOWN of its
+// address. A constructor runs once when a slab is carved, and
+// objects go back to the cache still constructed. The first word
+// of a free object links the free lists, so a constructor must
+// not keep state there.
+//
+// Each CPU keeps a few free objects of every cache and trades
+// them with the slabs BATCH at a time, so most allocations and
+// frees take no lock.
+//
+// kmalloc() serves small allocations of any size from a set of
+// power-of-two caches.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "x86.h"
+
+#define NKCACHE  32    // caches in the system
+#define CPUMAX   16    // free objects a CPU keeps per cache
+#define BATCH    8     // objects moved at a time
+#define KMALLOC_MIN 16
+#define KMALLOC_MAX 2048
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;     // partial list
+  struct slab *prev;
+  void *free;            // free objects in this slab
+  int inuse;             // objects handed out, cpu caches included
+};
+
+// Objects whose size is a multiple of 16 are 16-byte aligned,
+// as fxsave wants struct proc's fpu to be.
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+struct cpucache {
+  void *free;
+  int n;
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;             // object size, multiple of 8
+  int nobj;              // objects per slab
+  void (*ctor)(void*);
+  struct spinlock lock;  // protects partial and nslabs
+  struct slab *partial;  // slabs with free objects
+  int nslabs;
+  struct cpucache cpu[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  int n;
+  struct kmem_cache cache[NKCACHE];
+  struct kmem_cache *kmalloc[8];   // KMALLOC_MIN << i bytes
+} slabs;
+
+static char *kmalloc_names[] = {
+  "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+  "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+void
+slabinit(void)
+{
+  int i;
+
+  initlock(&slabs.lock, "slabs");
+  for(i = 0; KMALLOC_MIN << i <= KMALLOC_MAX; i++)
+    slabs.kmalloc[i] = kmem_cache_create(kmalloc_names[i],
+                                         KMALLOC_MIN << i, 0);
+}
+
+// Create a cache of objects of size bytes. ctor may be 0.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(void*) || size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: size");
+  acquire(&slabs.lock);
+  if(slabs.n == NKCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->size = size;
+  c->nobj = (PGSIZE - SLABHDR) / size;
+  c->ctor = ctor;
+  initlock(&c->lock, name);
+  return c;
+}
+
+// Carve a new slab. Caller holds c->lock.
+static struct slab*
+newslab(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *p;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  p = (char*)s + SLABHDR + (c->nobj - 1) * c->size;
+  for(i = 0; i < c->nobj; i++, p -= c->size){
+    if(c->ctor)
+      c->ctor(p);
+    *(void**)p = s->free;
+    s->free = p;
+  }
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+  c->nslabs++;
+  return s;
+}
+
+static void
+unlinkslab(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Move up to BATCH objects from the slabs to cc.
+static void
+refill(struct kmem_cache *c, struct cpucache *cc)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(cc->n < BATCH){
+    if((s = c->partial) == 0 && (s = newslab(c)) == 0)
+      break;
+    obj = s->free;
+    s->free = *(void**)obj;
+    if(++s->inuse == c->nobj)
+      unlinkslab(c, s);
+    *(void**)obj = cc->free;
+    cc->free = obj;
+    cc->n++;
+  }
+  release(&c->lock);
+}
+
+// Give objects from cc back to their slabs until it holds
+// CPUMAX - BATCH. Empty slabs go back to kalloc(), except
+// the last partial one.
+static void
+drain(struct kmem_cache *c, struct cpucache *cc)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(cc->n > CPUMAX - BATCH){
+    obj = cc->free;
+    cc->free = *(void**)obj;
+    cc->n--;
+    s = (struct slab*)PGROUNDDOWN((uint)obj);
+    *(void**)obj = s->free;
+    s->free = obj;
+    if(s->inuse-- == c->nobj){
+      s->prev = 0;
+      s->next = c->partial;
+      if(c->partial)
+        c->partial->prev = s;
+      c->partial = s;
+    }
+    if(s->inuse == 0 && (s->prev || s->next)){
+      unlinkslab(c, s);
+      c->nslabs--;
+      kfree((char*)s);
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate an object from c. Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct cpucache *cc;
+  void *obj;
+
+  pushcli();
+  cc = &c->cpu[cpuid()];
+  if(cc->free == 0)
+    refill(c, cc);
+  if((obj = cc->free) != 0){
+    cc->free = *(void**)obj;
+    cc->n--;
+  }
+  popcli();
+  return obj;
+}
+
+// Return obj, allocated from c, in its constructed state.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct cpucache *cc;
+
+  if(((struct slab*)PGROUNDDOWN((uint)obj))->cache != c)
+    panic("kmem_cache_free");
+  pushcli();
+  cc = &c->cpu[cpuid()];
+  *(void**)obj = cc->free;
+  cc->free = obj;
+  if(++cc->n > CPUMAX)
+    drain(c, cc);
+  popcli();
+}
+
+// Allocate n bytes, n at most KMALLOC_MAX.
+// Returns 0 if that cannot be done.
+void*
+kmalloc(uint n)
+{
+  int i;
+
+  for(i = 0; KMALLOC_MIN << i <= KMALLOC_MAX; i++)
+    if(n <= KMALLOC_MIN << i)
+      return kmem_cache_alloc(slabs.kmalloc[i]);
+  return 0;
+}
+
+// Free memory returned by kmalloc().
+void
+kmfree(void *p)
+{
+  kmem_cache_free(((struct slab*)PGROUNDDOWN((uint)p))->cache, p);
+}
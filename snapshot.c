@@ -0,0 +1,307 @@
+// Process snapshots.
+//
+// snapshot() writes the memory and registers of the current
+// process to a file, so that a program that takes long to set
+// itself up can save the result once and have later instances
+// start from it. restore() replaces the memory of the current
+// process with a snapshot, as exec() does with a program, and
+// returns to user space where snapshot() did, returning 1 there
+// instead of 0.
+//
+// Nothing is read when a snapshot is restored: its pages are
+// mapped as private file-backed regions of the image, which
+// pgfault() brings in from the page cache as they are touched,
+// so instances restored from one image share the pages none
+// of them writes.
+//
+// The image is a header page, then the pages of each range of
+// memory in turn. Only the span of a range between its first
+// and last used page is saved; the rest comes back zeroed.
+// Open files are not part of a snapshot, nor are threads,
+// shared memory segments or MAP_SHARED regions, and a process
+// using any of these cannot be saved.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define SNAPMAGIC 0x50414E53  // "SNAP"
+#define FL_STATUS 0x0CD5      // eflags user code may set: CF PF AF ZF SF DF OF
+#define NRANGE (2*NVMA + 1)   // regions, and the heap around them
+
+struct snaprange {
+  uint start, end;            // page aligned
+  uint lo, hi;                // the pages saved, at off in the file
+  uint off;
+  int writable;
+  int stack;                  // the user stack, see execproc()
+  int heap;                   // below sz, needing no region
+  int file;                   // backed by a file: all pages are saved
+};
+
+struct snaphdr {
+  uint magic;
+  uint sz;
+  uint tstack;
+  char name[16];
+  struct trapframe tf;
+  struct fxsave fpu;
+  uint nrange;
+  struct snaprange range[NRANGE];
+};
+
+// Add range [start, end) of p to h, with the span of pages
+// used in it. Pages of a file-backed range not read in yet
+// are not zero, so count as used. Returns -1 if there are
+// too many.
+static int
+addrange(struct proc *p, struct snaphdr *h, uint start, uint end,
+         int writable, int stack, int heap, int file)
+{
+  struct snaprange *r;
+  uint a;
+
+  if(h->nrange == NRANGE)
+    return -1;
+  r = &h->range[h->nrange++];
+  r->start = start;
+  r->end = end;
+  r->writable = writable;
+  r->stack = stack;
+  r->heap = heap;
+  r->file = file;
+  r->lo = r->hi = end;
+  for(a = start; a < end; a += PGSIZE){
+    if(file || uvmused(p->pgdir, a)){
+      if(r->lo == end)
+        r->lo = a;
+      r->hi = a + PGSIZE;
+    }
+  }
+  if(r->lo == end)
+    r->lo = r->hi = start;
+  return 0;
+}
+
+// Save the memory and registers of the current process to f,
+// which must be a file open for writing at offset 0. Returns 0,
+// or -1 if the process cannot be saved.
+int
+snapshot(struct file *f)
+{
+  struct proc *p = myproc();
+  struct snaphdr *h;
+  struct snaprange *r;
+  struct vma *v, *next;
+  uint a, end, off;
+  char *buf;
+
+  if(f->type != FD_INODE || !f->writable || f->off != 0 ||
+     p->vmowner != p || p->nthreads > 0)
+    return -1;
+  if((h = (struct snaphdr*)kzalloc()) == 0)
+    return -1;
+  if((buf = kalloc()) == 0){
+    kfree((char*)h);
+    return -1;
+  }
+  h->magic = SNAPMAGIC;
+  h->sz = p->sz;
+  h->tstack = p->tstack;
+  safestrcpy(h->name, p->name, sizeof(h->name));
+  h->tf = *p->tf;
+  fpusave(p);
+  h->fpu = p->fpu;
+
+  // The regions, then the heap: the rest of [0, sz).
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end == 0)
+      continue;
+    if(v->shm || v->shared ||
+       addrange(p, h, v->start, PGROUNDUP(v->end), v->writable,
+                v->stack, 0, v->ip != 0) < 0)
+      goto bad;
+  }
+  for(a = 0; a < PGROUNDUP(p->sz); a = end){
+    end = PGROUNDUP(p->sz);
+    next = 0;
+    for(v = p->vma; v < &p->vma[NVMA]; v++){
+      if(v->end && v->start <= a && a < v->end)
+        next = v;
+      else if(v->end && v->start > a && v->start < end)
+        end = v->start;
+    }
+    if(next)
+      end = PGROUNDUP(next->end);
+    else if(addrange(p, h, a, end, 1, 0, 1, 0) < 0)
+      goto bad;
+  }
+
+  off = PGSIZE;
+  for(r = h->range; r < &h->range[h->nrange]; r++){
+    r->off = off;
+    off += r->hi - r->lo;
+  }
+  if(filewrite(f, (char*)h, PGSIZE) != PGSIZE)
+    goto bad;
+  for(r = h->range; r < &h->range[h->nrange]; r++){
+    for(a = r->lo; a < r->hi; a += PGSIZE){
+      if(!r->file && !uvmused(p->pgdir, a))
+        memset(buf, 0, PGSIZE);
+      else if(prefault(p, a, PGSIZE, 0) == 0)
+        memmove(buf, (char*)a, PGSIZE);
+      else
+        goto bad;
+      // Unpin the page once copied, so that saving a process
+      // larger than memory does not pin all of it.
+      p->pinlo = p->pinhi = 0;
+      if(filewrite(f, buf, PGSIZE) != PGSIZE)
+        goto bad;
+    }
+  }
+  kfree(buf);
+  kfree((char*)h);
+  return 0;
+
+bad:
+  kfree(buf);
+  kfree((char*)h);
+  return -1;
+}
+
+// Add region [start, end) to vma, backed by ip at off if ip
+// is not 0. Returns -1 if there are too many.
+static int
+addvma(struct vma *vma, int *nvma, uint start, uint end, struct inode *ip,
+       uint off, struct snaprange *r, int stack)
+{
+  struct vma *v;
+
+  if(start == end)
+    return 0;
+  if(*nvma == NVMA)
+    return -1;
+  v = &vma[(*nvma)++];
+  v->start = start;
+  v->end = end;
+  v->off = off;
+  v->filesz = ip ? end - start : 0;
+  v->writable = r->writable;
+  v->shared = 0;
+  v->ip = ip;
+  v->shm = 0;
+  v->stack = stack;
+  return 0;
+}
+
+// Replace the memory and registers of the current process
+// with the snapshot at path. Returns 1, which syscall() puts
+// in %eax as the return value of snapshot() in the restored
+// process, or -1, leaving the process as it was, if that
+// cannot be done.
+int
+restore(char *path)
+{
+  struct proc *p = myproc();
+  struct snaphdr *h;
+  struct snaprange *r, *r1;
+  struct vma vma[NVMA];
+  struct trapframe tf;
+  struct inode *ip;
+  pde_t *pgdir, *oldpgdir;
+  int i, nvma;
+
+  if(p->vmowner != p || p->nthreads > 0)
+    return -1;
+  if((h = (struct snaphdr*)kalloc()) == 0)
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    kfree((char*)h);
+    return -1;
+  }
+  ilock(ip);
+  pgdir = 0;
+  if(readi(ip, (char*)h, 0, PGSIZE) != PGSIZE || h->magic != SNAPMAGIC ||
+     h->nrange > NRANGE || h->sz >= KERNBASE)
+    goto bad;
+
+  // Check the ranges, and turn them into regions.
+  nvma = 0;
+  for(r = h->range; r < &h->range[h->nrange]; r++){
+    if(r->start % PGSIZE || r->end % PGSIZE || r->lo % PGSIZE ||
+       r->hi % PGSIZE || r->off % PGSIZE || r->start >= r->end ||
+       r->end > KERNBASE || r->lo < r->start || r->hi < r->lo ||
+       r->hi > r->end || r->off + (r->hi - r->lo) < r->off ||
+       r->off + (r->hi - r->lo) > ip->size)
+      goto bad;
+    if(r->heap && r->end > PGROUNDUP(h->sz))
+      goto bad;
+    for(r1 = h->range; r1 < r; r1++)
+      if(r1->start < r->end && r1->end > r->start)
+        goto bad;
+    if(addvma(vma, &nvma, r->lo, r->hi, ip, r->off, r, 0) < 0)
+      goto bad;
+    if(r->heap)
+      continue;  // the rest is zero-filled below sz
+    if(addvma(vma, &nvma, r->start, r->lo, 0, 0, r, r->stack) < 0 ||
+       addvma(vma, &nvma, r->hi, r->end, 0, 0, r, 0) < 0)
+      goto bad;
+  }
+  if((pgdir = setupkvm()) == 0)
+    goto bad;
+  iunlock(ip);
+  end_op();
+
+  // Commit to the image, as exec() does.
+  vmasyncall(p);
+  begin_op();
+  vmaput(p);
+  for(i = 0; i < nvma; i++){
+    p->vma[i] = vma[i];
+    if(vma[i].ip)
+      idup(ip);
+  }
+  iput(ip);
+  end_op();
+  growlock(p);
+  oldpgdir = p->pgdir;
+  p->pgdir = pgdir;
+  p->sz = h->sz;
+  growunlock(p);
+  // Only the general registers come from the image: the segments
+  // stay user segments, and eflags can only carry status flags.
+  tf = *p->tf;
+  *p->tf = h->tf;
+  p->tf->cs = tf.cs;
+  p->tf->ds = tf.ds;
+  p->tf->es = tf.es;
+  p->tf->fs = tf.fs;
+  p->tf->gs = tf.gs;
+  p->tf->ss = tf.ss;
+  p->tf->eflags = (h->tf.eflags & FL_STATUS) | FL_IF;
+  fpuload(p, &h->fpu);
+  p->tstack = h->tstack;
+  safestrcpy(p->name, h->name, sizeof(p->name));
+  kfree((char*)h);
+  switchuvm(p);
+  freevm(oldpgdir);
+  return 1;
+
+ bad:
+  if(pgdir)
+    freevm(pgdir);
+  iunlockput(ip);
+  end_op();
+  kfree((char*)h);
+  return -1;
+}
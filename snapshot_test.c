@@ -0,0 +1,105 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+
+// Saves the process with snapshot() and starts copies of it with
+// restore() in forked children. Each copy must find the heap, the
+// data and the stack as they were when the snapshot was taken,
+// and the pages it writes must stay its own.
+
+#define PGSIZE 4096
+#define NPG 64
+#define NCOPY 3
+#define IMAGE "snapshot.img"
+
+int counter;
+
+void fail(char *why)
+{
+    printf(1, "snapshot_test: %s failed\n", why);
+    exit();
+}
+
+int check(int *table, int first)
+{
+    int i;
+
+    if(table[0] != first)
+        return -1;
+    for(i = 1; i < NPG; i++)
+        if(table[i * (PGSIZE / 4)] != i * 7)
+            return -1;
+    return 0;
+}
+
+int main(void)
+{
+    int *table;
+    volatile int local;
+    int i, fd, r, p[2];
+    char c;
+
+    if(pipe(p) < 0)
+        fail("pipe");
+    if((table = (int *)sbrk(NPG * PGSIZE)) == (int *)-1)
+        fail("sbrk");
+    for(i = 0; i < NPG; i++)
+        table[i * (PGSIZE / 4)] = i * 7;
+    counter = 100;
+    local = 0x5a5a;
+
+    unlink(IMAGE);
+    if((fd = open(IMAGE, O_CREATE | O_WRONLY)) < 0)
+        fail("open");
+    if((r = snapshot(fd)) < 0)
+        fail("snapshot");
+    if(r == 1){
+        // A restored copy.
+        c = check(table, 0) == 0 && counter == 100 && local == 0x5a5a;
+        table[0] = -1;
+        counter++;
+        write(p[1], &c, 1);
+        exit();
+    }
+    close(fd);
+
+    // Changes after the snapshot are not in it.
+    table[0] = 12345;
+    counter = 0;
+    local = 0;
+
+    if((fd = open(IMAGE, O_WRONLY)) < 0)
+        fail("open");
+    write(fd, "x", 1);
+    if(snapshot(fd) != -1)
+        fail("snapshot at offset");
+    close(fd);
+    if((fd = open("README", O_RDONLY)) < 0)
+        fail("open README");
+    if(snapshot(fd) != -1)
+        fail("snapshot read-only");
+    close(fd);
+    if(restore("README") != -1 || restore("nonexistent") != -1)
+        fail("restore of a bad image");
+
+    for(i = 0; i < NCOPY; i++){
+        if((r = fork()) < 0)
+            fail("fork");
+        if(r == 0){
+            restore(IMAGE);
+            c = 0;
+            write(p[1], &c, 1);
+            exit();
+        }
+    }
+    for(i = 0; i < NCOPY; i++)
+        if(read(p[0], &c, 1) != 1 || !c)
+            fail("restored copy");
+    for(i = 0; i < NCOPY; i++)
+        wait();
+    if(check(table, 12345) < 0 || counter != 0 || local != 0)
+        fail("parent after restore");
+    unlink(IMAGE);
+    printf(1, "snapshot_test: OK\n");
+    exit();
+}
@@ -0,0 +1,63 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+
+// Checks that spawn() runs a program with the file descriptors
+// it is given, reports a missing program or a bad descriptor,
+// and with no descriptor map passes all of them on.
+
+void fail(char *why)
+{
+    printf(1, "spawn_test: %s failed\n", why);
+    exit();
+}
+
+int main(void)
+{
+    char *argv[] = { "echo", "hello", "spawn", 0 };
+    char *bad[] = { "no_such_program", 0 };
+    char buf[64];
+    int p[2], fd[3], n, i, pid;
+
+    if(pipe(p) < 0)
+        fail("pipe");
+    fd[0] = 0;
+    fd[1] = p[1];
+    fd[2] = 2;
+    if((pid = spawn("echo", argv, fd, 3)) < 0)
+        fail("spawn");
+    close(p[1]);
+    for(i = 0; i < sizeof(buf) - 1 && (n = read(p[0], buf + i, sizeof(buf) - 1 - i)) > 0; i += n)
+        ;
+    buf[i] = 0;
+    close(p[0]);
+    if(wait() != pid)
+        fail("wait");
+    if(strcmp(buf, "hello spawn\n") != 0)
+        fail("output through the pipe");
+
+    if(spawn("no_such_program", bad, 0, 0) >= 0)
+        fail("missing program");
+    fd[1] = 15;
+    if(spawn("echo", argv, fd, 3) >= 0)
+        fail("bad descriptor");
+
+    // Without a map the child has our descriptors.
+    if(pipe(p) < 0)
+        fail("pipe");
+    close(1);
+    dup(p[1]);
+    close(p[1]);
+    pid = spawn("echo", argv, 0, 0);
+    close(1);
+    open("console", O_WRONLY);
+    if(pid < 0 || read(p[0], buf, 5) != 5)
+        fail("inherited descriptors");
+    buf[5] = 0;
+    if(strcmp(buf, "hello") != 0)
+        fail("inherited descriptors");
+    close(p[0]);
+    wait();
+    printf(1, "spawn_test: OK\n");
+    exit();
+}
@@ -29,8 +29,9 @@ acquire(struct spinlock *lk)
     panic("acquire");
 
   // The xchg is atomic.
+  // The holder may be waiting for this CPU to flush its TLB.
   while(xchg(&lk->locked, 1) != 0)
-    ;
+    tlbpoll();
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -0,0 +1,103 @@
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+
+// The user stack grows on demand: recurses through a few MB of
+// stack, passes buffers on the stack to system calls, and checks
+// that a child that recurses without end is killed when it runs
+// into the guard page rather than corrupting memory.
+
+#define FRAME 4096
+#define DEPTH 512      // 2 MB of frames
+#define BUFSZ (32 * 1024)
+
+void fail(char *why)
+{
+    printf(1, "stack_test: %s failed\n", why);
+    exit();
+}
+
+// Fill a frame, recurse, then check that the frame is intact.
+int recurse(int depth)
+{
+    char frame[FRAME];
+    int i, sum;
+
+    for(i = 0; i < FRAME; i++)
+        frame[i] = depth + i;
+    sum = depth > 0 ? recurse(depth - 1) : 0;
+    for(i = 0; i < FRAME; i += 61)
+        if(frame[i] != (char)(depth + i))
+            return -1;
+    return sum < 0 ? -1 : sum + depth;
+}
+
+// Recurse through 16 MB, twice the most the stack can grow to.
+int toodeep(int depth)
+{
+    volatile char frame[FRAME];
+
+    frame[0] = depth;
+    if(depth == 4096)
+        return 0;
+    return toodeep(depth + 1) + frame[0];
+}
+
+void buffers(void)
+{
+    char out[BUFSZ], in[BUFSZ];
+    int fd, i;
+
+    for(i = 0; i < BUFSZ; i++)
+        out[i] = i * 7;
+    if((fd = open("stack_test.tmp", O_CREATE | O_RDWR)) < 0)
+        fail("open");
+    if(write(fd, out, BUFSZ) != BUFSZ)
+        fail("write from the stack");
+    close(fd);
+    if((fd = open("stack_test.tmp", O_RDONLY)) < 0)
+        fail("reopen");
+    if(read(fd, in, BUFSZ) != BUFSZ)
+        fail("read to the stack");
+    close(fd);
+    unlink("stack_test.tmp");
+    for(i = 0; i < BUFSZ; i++)
+        if(in[i] != out[i])
+            fail("stack buffer contents");
+}
+
+int main(void)
+{
+    int pid, fd[2];
+    char c;
+
+    if(recurse(DEPTH) != DEPTH * (DEPTH + 1) / 2)
+        fail("deep recursion");
+    buffers();
+
+    // A child gets a copy of the grown stack.
+    if((pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0){
+        if(recurse(DEPTH) != DEPTH * (DEPTH + 1) / 2)
+            fail("recursion in child");
+        exit();
+    }
+    wait();
+
+    if(pipe(fd) < 0 || (pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0){
+        close(fd[0]);
+        toodeep(0);
+        write(fd[1], "x", 1);
+        exit();
+    }
+    close(fd[1]);
+    if(read(fd[0], &c, 1) != 0)
+        fail("overflow");
+    close(fd[0]);
+    wait();
+    printf(1, "stack_test: OK\n");
+    exit();
+}
@@ -0,0 +1,89 @@
+#include "types.h"
+#include "param.h"
+#include "user.h"
+#include "memstat.h"
+
+// Checks that sbrkhuge() memory is 4 MB aligned, reads as zero,
+// survives a fork (which splits the superpages for copy-on-write)
+// and can be given back with a negative sbrk; and that sparsely
+// touched sbrk() memory is not mapped with superpages.
+
+#define SPGSIZE (4*1024*1024)
+#define NSPG 3
+#define MB (1024*1024)
+
+void fail(char *why)
+{
+    printf(1, "superpage_test: %s failed\n", why);
+    exit();
+}
+
+uint rss(void)
+{
+    struct procmem pm;
+    int n;
+
+    for(n = 0; procmem(n, &pm) == 0; n++)
+        if(pm.pid == getpid())
+            return pm.rss;
+    fail("finding self");
+    return 0;
+}
+
+int main(void)
+{
+    char *p, *top;
+    uint before;
+    int i, pid;
+
+    top = sbrk(0);
+    p = sbrkhuge(NSPG * SPGSIZE - 100);
+    if(p == (char *)-1)
+        fail("sbrkhuge");
+    if((uint)p % SPGSIZE || p < top || sbrk(0) != p + NSPG * SPGSIZE)
+        fail("alignment");
+    for(i = 0; i < NSPG * SPGSIZE; i += 4096){
+        if(p[i] != 0 || p[i + 4095] != 0)
+            fail("zero fill");
+        p[i] = i / 4096;
+    }
+
+    pid = fork();
+    if(pid < 0)
+        fail("fork");
+    if(pid == 0){
+        for(i = 0; i < NSPG * SPGSIZE; i += 4096){
+            if(p[i] != (char)(i / 4096))
+                fail("child read");
+            p[i] = 0x5a;
+        }
+        exit();
+    }
+    wait();
+    for(i = 0; i < NSPG * SPGSIZE; i += 4096)
+        if(p[i] != (char)(i / 4096))
+            fail("copy-on-write");
+
+    // shrink into the middle of a superpage, then back
+    if(sbrk(-(SPGSIZE + SPGSIZE / 2)) == (char *)-1)
+        fail("shrink");
+    if(p[SPGSIZE + 4096] != (char)(SPGSIZE / 4096 + 1))
+        fail("kept memory");
+    if(sbrk(SPGSIZE / 2) == (char *)-1 || p[SPGSIZE + SPGSIZE / 2] != 0)
+        fail("regrow");
+    if(sbrk(-(2 * SPGSIZE)) == (char *)-1)
+        fail("free");
+
+    // One word per MB of plain sbrk() memory costs a page each.
+    before = rss();
+    if((p = sbrk(3 * SPGSIZE)) == (char *)-1)
+        fail("sbrk");
+    for(i = 0; i < 3 * SPGSIZE; i += MB)
+        p[i] = 1;
+    if(rss() - before > 3 * SPGSIZE / MB + 8)
+        fail("sparse sbrk memory");
+    if(sbrk(-3 * SPGSIZE) == (char *)-1)
+        fail("sparse free");
+    printf(1, "superpage_test: OK\n");
+    exit();
+}
@@ -0,0 +1,226 @@
+// Swap space.
+//
+// When memory runs out, reclaim() in proc.c walks the user page
+// tables with a clock hand, and swapscan() in vm.c picks pages
+// that have not been used since the hand last passed them. Each
+// one is given a slot of swap space here with swapqueue(): its
+// page table entry becomes a non-present PTE_SWAP entry holding
+// the slot number, and the page is written out by swapflush()
+// and freed. A fault on the entry reads the page back, see
+// swapin() in vm.c.
+//
+// The swap space is a region at the end of the disk, after the
+// file system; mkfs records where it is in the super block. It
+// is read and written a page at a time, around the buffer cache
+// and the log.
+//
+// A slot holds one reference per page table entry naming it, so
+// that fork() can share swapped pages, and one while it is read
+// or written.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+#define BPP (PGSIZE / BSIZE)    // blocks per page
+
+struct swapio {
+  uint slot;
+  char *page;                   // page being written to slot
+};
+
+static struct {
+  struct spinlock lock;
+  int dev;
+  uint start;                   // first block
+  uint nslot;                   // 0 if there is no swap space
+  uint next;                    // where to look for a free slot
+  uint nused;
+  ushort ref[NSWAP];            // references to each slot
+  struct swapio io[SWAPBATCH];  // queued by swapqueue(), protected by
+  int nio;                      // reclaim()'s lock as well as lock
+  struct buf buf;               // for disk transfers
+} swap;
+
+void
+swapinit(int dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.buf.lock, "swapbuf");
+  readsb(dev, &sb);
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap < NSWAP ? sb.nswap : NSWAP;
+}
+
+// Read or write page at slot, a block at a time.
+static void
+swaprw(uint slot, char *page, int write)
+{
+  struct buf *b = &swap.buf;
+  int i;
+
+  acquiresleep(&b->lock);
+  for(i = 0; i < BPP; i++){
+    b->dev = swap.dev;
+    b->blockno = swap.start + slot*BPP + i;
+    if(write){
+      memmove(b->data, page + i*BSIZE, BSIZE);
+      b->flags = B_DIRTY;
+    } else
+      b->flags = 0;
+    iderw(b);
+    if(!write)
+      memmove(page + i*BSIZE, b->data, BSIZE);
+  }
+  releasesleep(&b->lock);
+}
+
+// Give page a slot and queue it to be written there by
+// swapflush(), which frees it. The caller, swapscan(), puts
+// the slot, which has one reference, in the page table
+// entry instead of the page. Returns the slot, or -1 if the
+// swap space or the queue is full.
+int
+swapqueue(char *page)
+{
+  uint s;
+
+  acquire(&swap.lock);
+  if(swap.nio == SWAPBATCH || swap.nused == swap.nslot){
+    release(&swap.lock);
+    return -1;
+  }
+  for(s = swap.next % swap.nslot; swap.ref[s]; s = (s + 1) % swap.nslot)
+    ;
+  swap.next = s + 1;
+  swap.nused++;
+  swap.ref[s] = 2;              // the entry, and swapflush()
+  swap.io[swap.nio].slot = s;
+  swap.io[swap.nio].page = page;
+  swap.nio++;
+  release(&swap.lock);
+  return s;
+}
+
+// Write the pages queued by swapqueue() and free them.
+// Returns how many there were. Called by reclaim().
+int
+swapflush(void)
+{
+  struct swapio *io;
+  int n;
+
+  for(io = swap.io; io < &swap.io[swap.nio]; io++)
+    swaprw(io->slot, io->page, 1);
+  acquire(&swap.lock);
+  n = swap.nio;
+  swap.nio = 0;
+  release(&swap.lock);
+  for(io = swap.io; io < &swap.io[n]; io++){
+    swapfree(io->slot);
+    kfree(io->page);
+  }
+  return n;
+}
+
+// Add a reference to slot. Returns -1 if it has as many as
+// the count can hold.
+int
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  if(swap.ref[slot] == 0xFFFF){
+    release(&swap.lock);
+    return -1;
+  }
+  swap.ref[slot]++;
+  release(&swap.lock);
+  return 0;
+}
+
+// Drop a reference to slot, freeing it when none are left.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Read the page at slot into page. The caller holds a
+// reference to slot. A page still waiting to be written
+// is copied instead.
+void
+swapread(uint slot, char *page)
+{
+  struct swapio *io;
+
+  acquire(&swap.lock);
+  for(io = swap.io; io < &swap.io[swap.nio]; io++){
+    if(io->slot == slot){
+      memmove(page, io->page, PGSIZE);
+      release(&swap.lock);
+      return;
+    }
+  }
+  release(&swap.lock);
+  swaprw(slot, page, 0);
+}
+
+// Report the size of the swap space and how much is free,
+// in pages.
+void
+swapcount(uint *total, uint *nfree)
+{
+  acquire(&swap.lock);
+  *total = swap.nslot;
+  *nfree = swap.nslot - swap.nused;
+  release(&swap.lock);
+}
+
+// Allocate a page as kalloc() does, or kallocuser() if user
+// is set, but if memory has run out, push user pages out to
+// swap until one is free. Sleeps,
+// so the caller must not hold growlock(). A caller holding a
+// spinlock, such as a page fault taken by kernel code copying
+// to user memory under a lock, gets plain kalloc() instead.
+char*
+kallocswap(int user)
+{
+  char *v;
+  int locked;
+
+  pushcli();
+  locked = mycpu()->ncli > 1;
+  popcli();
+  while((v = user ? kallocuser() : kalloc()) == 0)
+    if(locked || reclaim(SWAPBATCH) == 0)
+      return 0;
+  return v;
+}
+
+// Allocate a zeroed page, as kallocswap().
+char*
+kzallocswap(int user)
+{
+  char *v;
+
+  if((v = user ? kzallocuser() : kzalloc()) == 0 &&
+     (v = kallocswap(user)) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
@@ -0,0 +1,62 @@
+#include "types.h"
+#include "user.h"
+
+// Touches more memory than the machine has, so that pages are
+// pushed out to swap, and checks that they read back intact,
+// in the process itself and in a child forked while some of
+// them were out. The default size is a little more than the
+// 512 MB that make qemu gives the machine; it takes a while.
+//
+// usage: swap_test [megabytes]
+
+#define PGSIZE 4096
+#define STEP 7      // pages between the ones checked
+
+void fail(char *why)
+{
+    printf(1, "swap_test: %s failed\n", why);
+    exit();
+}
+
+int check(int *p, int npg)
+{
+    int i;
+
+    for(i = 0; i < npg; i += STEP)
+        if(p[i * (PGSIZE / 4)] != i || p[i * (PGSIZE / 4) + 1023] != ~i)
+            return -1;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int *p;
+    int mb, npg, i, pid, fd[2];
+    char c;
+
+    mb = argc > 1 ? atoi(argv[1]) : 544;
+    npg = mb * (1024 * 1024 / PGSIZE);
+    if((p = (int *)sbrk(npg * PGSIZE)) == (int *)-1)
+        fail("sbrk");
+    for(i = 0; i < npg; i++){
+        p[i * (PGSIZE / 4)] = i;
+        p[i * (PGSIZE / 4) + 1023] = ~i;
+    }
+    if(check(p, npg) < 0)
+        fail("read back");
+
+    if(pipe(fd) < 0 || (pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0){
+        c = check(p, npg) == 0;
+        write(fd[1], &c, 1);
+        exit();
+    }
+    if(read(fd[0], &c, 1) != 1 || !c)
+        fail("child after fork");
+    wait();
+    if(check(p, npg) < 0)
+        fail("parent after fork");
+    printf(1, "swap_test: OK\n");
+    exit();
+}
@@ -18,8 +18,11 @@ int
 fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
+  uint end;
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if((end = uend(curproc, addr)) == 0 || addr+4 < addr || addr+4 > end)
+    return -1;
+  if(prefault(curproc, addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -33,12 +36,15 @@ fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
   struct proc *curproc = myproc();
+  uint end;
 
-  if(addr >= curproc->sz)
+  if((end = uend(curproc, addr)) == 0)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
+  ep = (char*)end;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && prefault(curproc, (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -54,16 +60,21 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
+// lies within the process address space, and if write is set,
+// that the kernel may store to the block.
 int
-argptr(int n, char **pp, int size)
+argptr(int n, char **pp, int size, int write)
 {
   int i;
+  uint end;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (end = uend(curproc, i)) == 0 || (uint)i+size < (uint)i ||
+     (uint)i+size > end)
+    return -1;
+  if(prefault(curproc, i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -115,6 +126,21 @@ extern int sys_set_priority(void);
 extern int sys_change_policy(void);
 extern int sys_update_proc_timing(void);
 extern int sys_get_proc_timing(void);
+extern int sys_thread_join_any(void);
+extern int sys_getncpu(void);
+// Memory management
+extern int sys_sbrkhuge(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_msync(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_spawn(void);
+extern int sys_procmem(void);
+extern int sys_sysmem(void);
+extern int sys_setmempolicy(void);
+extern int sys_snapshot(void);
+extern int sys_restore(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -149,7 +175,22 @@ static int (*syscalls[])(void) = {
 [SYS_set_priority] sys_set_priority,
 [SYS_change_policy] sys_change_policy,
 [SYS_update_proc_timing] sys_update_proc_timing,
-[SYS_get_proc_timing] sys_get_proc_timing
+[SYS_get_proc_timing] sys_get_proc_timing,
+[SYS_thread_join_any] sys_thread_join_any,
+[SYS_getncpu] sys_getncpu,
+// Memory management
+[SYS_sbrkhuge] sys_sbrkhuge,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_msync]   sys_msync,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_spawn]   sys_spawn,
+[SYS_procmem] sys_procmem,
+[SYS_sysmem]  sys_sysmem,
+[SYS_setmempolicy] sys_setmempolicy,
+[SYS_snapshot] sys_snapshot,
+[SYS_restore] sys_restore,
 };
 
 void
@@ -161,6 +202,7 @@ syscall(void)
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     curproc->tf->eax = syscalls[num]();
+    curproc->pinlo = curproc->pinhi = 0;
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
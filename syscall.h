@@ -35,3 +35,21 @@
 #define SYS_change_policy 28
 #define SYS_update_proc_timing 29
 #define SYS_get_proc_timing 30
+
+// Thread join by completion
+#define SYS_thread_join_any 31
+#define SYS_getncpu 32
+
+// Memory management
+#define SYS_sbrkhuge 33
+#define SYS_mmap     34
+#define SYS_munmap   35
+#define SYS_msync    36
+#define SYS_shmat    37
+#define SYS_shmdt    38
+#define SYS_spawn    39
+#define SYS_procmem  40
+#define SYS_sysmem   41
+#define SYS_setmempolicy 42
+#define SYS_snapshot 43
+#define SYS_restore  44
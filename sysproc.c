@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "memstat.h"
+#include "mman.h"
 
 int
 sys_fork(void)
@@ -50,8 +52,66 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  // growproc() reads the size itself, another thread
+  // may grow the shared address space first.
+  if((addr = growproc(n, 0)) < 0)
+    return -1;
+  return addr;
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+int
+sys_msync(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return msync(addr, len);
+}
+
+int
+sys_shmat(void)
+{
+  char *name;
+  int size;
+
+  if(argstr(0, &name) < 0 || argint(1, &size) < 0 || size < 0)
+    return -1;
+  return shmat(name, size);
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdt(addr);
+}
+
+// Like sbrk(), but the new memory starts at a 4 MB boundary
+// and is rounded up to 4 MB, so that pgfault() can map all
+// of it with superpages. Only memory from here gets them.
+int
+sys_sbrkhuge(void)
+{
+  int addr;
+  int n;
+
+  if(argint(0, &n) < 0 || n <= 0)
+    return -1;
+  if((addr = growproc(n, SPGSIZE)) < 0)
     return -1;
   return addr;
 }
@@ -127,6 +187,70 @@ sys_thread_join(void)
   return thread_join(tid);
 }
 
+int
+sys_thread_join_any(void)
+{
+  return thread_join_any();
+}
+
+// number of CPUs started at boot
+int
+sys_getncpu(void)
+{
+  return ncpu;
+}
+
+int
+sys_procmem(void)
+{
+  int n;
+  struct procmem *pm;
+
+  if(argint(0, &n) < 0 || argptr(1, (char**)&pm, sizeof(*pm), 1) < 0)
+    return -1;
+  return procmem(n, pm);
+}
+
+// physical memory and swap space, in pages
+int
+sys_sysmem(void)
+{
+  struct sysmem *sm;
+  int i;
+
+  if(argptr(0, (char**)&sm, sizeof(*sm), 1) < 0)
+    return -1;
+  sm->total = kpages();
+  sm->free = knfree(-1);
+  swapcount(&sm->swaptotal, &sm->swapfree);
+  sm->nnode = nnode;
+  for(i = 0; i < NNODE; i++){
+    sm->nodetotal[i] = i < nnode ? knodepages(i) : 0;
+    sm->nodefree[i] = i < nnode ? knfree(i) : 0;
+  }
+  return 0;
+}
+
+// where the pages of user memory the process allocates come
+// from: mode is one of the MPOL_ constants in mman.h, node the
+// node for MPOL_PREFERRED and MPOL_BIND
+int
+sys_setmempolicy(void)
+{
+  int mode, node;
+  struct proc *p = myproc();
+
+  if(argint(0, &mode) < 0 || argint(1, &node) < 0)
+    return -1;
+  if(mode < MPOL_LOCAL || mode > MPOL_INTERLEAVE ||
+     ((mode == MPOL_PREFERRED || mode == MPOL_BIND) &&
+      (node < 0 || node >= nnode)))
+    return -1;
+  p->mpol = mode;
+  p->mpolnode = node;
+  return 0;
+}
+
 int
 sys_set_priority(void){
   int priority = 0;
@@ -151,7 +275,7 @@ sys_update_proc_timing(void){
 int 
 sys_get_proc_timing(void){
   void *ret;
-  if(argptr(0,(char**)&ret, sizeof(struct time_data)) < 0)
+  if(argptr(0,(char**)&ret, sizeof(struct time_data), 1) < 0)
     return -1;
   return get_proc_timing(ret);
 }
@@ -0,0 +1,316 @@
+#include "types.h"
+#include "user.h"
+#include "atomic.h"
+#include "thread.h"
+#include "taskpool.h"
+
+// Work-stealing task pool.
+// Every worker owns a Chase-Lev deque: it pushes and pops at the
+// bottom, other workers steal from the top. Threads that are not
+// workers (e.g. main) submit through a small locked queue.
+
+#define PGSIZE 4096
+#define MAXWORKERS 8        // NCPU in param.h
+#define DEQSIZE 1024        // tasks per deque, power of two
+#define INJSIZE 256         // tasks queued by non-workers
+#define IDLESPINS 2000      // failed searches before sleeping a tick
+
+struct deque {
+    volatile int top;
+    volatile int bottom;
+    struct task * volatile buf[DEQSIZE];
+};
+
+struct worker {
+    struct deque dq;
+    uint stackpg;            // stack page of the worker thread
+    int tid;
+    volatile int stop;
+    uint seed;
+};
+
+static struct {
+    volatile int n;
+    struct worker w[MAXWORKERS];
+    volatile uint lock;      // protects inj, head and tail
+    int head;
+    int tail;
+    struct task *inj[INJSIZE];
+} pool;
+
+// owner only, -1 if deque is full
+static int
+dq_push(struct deque *d, struct task *t)
+{
+    int b = d->bottom;
+
+    if(b - d->top >= DEQSIZE)
+        return -1;
+    d->buf[b & (DEQSIZE - 1)] = t;
+    atomic_barrier();
+    d->bottom = b + 1;
+    return 0;
+}
+
+// owner only
+static struct task*
+dq_pop(struct deque *d)
+{
+    int b, t;
+    struct task *x;
+
+    b = d->bottom - 1;
+    d->bottom = b;
+    atomic_fence();
+    t = d->top;
+    if(t > b){
+        // empty
+        d->bottom = b + 1;
+        return 0;
+    }
+    x = d->buf[b & (DEQSIZE - 1)];
+    if(t == b){
+        // last task, race against thieves for it
+        if(!atomic_cas((volatile uint *)&d->top, t, t + 1))
+            x = 0;
+        d->bottom = b + 1;
+    }
+    return x;
+}
+
+// any thread
+static struct task*
+dq_steal(struct deque *d)
+{
+    int t, b;
+    struct task *x;
+
+    t = d->top;
+    atomic_barrier();
+    b = d->bottom;
+    if(t >= b)
+        return 0;
+    x = d->buf[t & (DEQSIZE - 1)];
+    if(!atomic_cas((volatile uint *)&d->top, t, t + 1))
+        return 0;
+    return x;
+}
+
+static int
+inj_push(struct task *t)
+{
+    int ok = 0;
+
+    while(atomic_xchg(&pool.lock, 1) != 0)
+        atomic_pause();
+    if(pool.tail - pool.head < INJSIZE){
+        pool.inj[pool.tail++ % INJSIZE] = t;
+        ok = 1;
+    }
+    atomic_xchg(&pool.lock, 0);
+    return ok ? 0 : -1;
+}
+
+static struct task*
+inj_take(void)
+{
+    struct task *t = 0;
+
+    if(pool.head == pool.tail)
+        return 0;
+    while(atomic_xchg(&pool.lock, 1) != 0)
+        atomic_pause();
+    if(pool.head != pool.tail)
+        t = pool.inj[pool.head++ % INJSIZE];
+    atomic_xchg(&pool.lock, 0);
+    return t;
+}
+
+// worker running on the caller's stack, 0 if not a worker
+static struct worker*
+self(void)
+{
+    uint pg = (uint)&pg & ~(PGSIZE - 1);
+    int i;
+
+    for(i = 0; i < pool.n; i++)
+        if(pool.w[i].stackpg == pg)
+            return &pool.w[i];
+    return 0;
+}
+
+static struct task*
+findwork(struct worker *me)
+{
+    static uint extseed;
+    struct task *t;
+    uint r;
+    int i, n = pool.n;
+
+    if(me && (t = dq_pop(&me->dq)) != 0)
+        return t;
+    if(n > 0){
+        // steal, starting at a random victim
+        if(me)
+            r = me->seed = me->seed * 1103515245 + 12345;
+        else
+            r = extseed++;
+        for(i = 0; i < n; i++){
+            struct worker *w = &pool.w[(r + i) % n];
+            if(w != me && (t = dq_steal(&w->dq)) != 0)
+                return t;
+        }
+    }
+    return inj_take();
+}
+
+static void
+run(struct task *t)
+{
+    t->fn(t->arg);
+    atomic_barrier();
+    t->done = 1;
+}
+
+static void
+workerloop(void *arg)
+{
+    struct worker *me = &pool.w[(int)arg];
+    struct task *t;
+    int idle = 0;
+
+    me->stackpg = (uint)&t & ~(PGSIZE - 1);
+    while(!me->stop){
+        if((t = findwork(me)) != 0){
+            run(t);
+            idle = 0;
+        } else if(++idle >= IDLESPINS){
+            sleep(1);
+            idle = 0;
+        }
+    }
+}
+
+int
+pool_start(int nworkers)
+{
+    int i;
+
+    if(pool.n > 0)
+        return -1;
+    if(nworkers <= 0)
+        nworkers = getncpu();
+    if(nworkers > MAXWORKERS)
+        nworkers = MAXWORKERS;
+    memset(&pool, 0, sizeof(pool));
+    for(i = 0; i < nworkers; i++)
+        pool.w[i].seed = i + 1;
+    pool.n = nworkers;
+    for(i = 0; i < nworkers; i++){
+        if((pool.w[i].tid = thread_creator(&workerloop, (void *)i)) < 0){
+            pool.n = i;
+            pool_stop();
+            return -1;
+        }
+    }
+    return nworkers;
+}
+
+void
+pool_stop(void)
+{
+    int i;
+
+    for(i = 0; i < pool.n; i++)
+        pool.w[i].stop = 1;
+    for(i = 0; i < pool.n; i++)
+        thread_joiner(pool.w[i].tid);
+    pool.n = 0;
+}
+
+int
+pool_size(void)
+{
+    return pool.n;
+}
+
+void
+pool_async(struct task *t, void (*fn)(void *), void *arg)
+{
+    struct worker *me;
+
+    t->fn = fn;
+    t->arg = arg;
+    t->done = 0;
+    if(pool.n == 0){
+        run(t);
+        return;
+    }
+    me = self();
+    if(me ? dq_push(&me->dq, t) : inj_push(t))
+        run(t);   // queue full, run it here
+}
+
+void
+pool_wait(struct task *t)
+{
+    struct worker *me = self();
+    struct task *x;
+
+    while(!t->done){
+        if((x = findwork(me)) != 0)
+            run(x);
+    }
+    atomic_barrier();
+}
+
+struct pfor {
+    int lo;
+    int hi;
+    int grain;
+    void (*body)(int, int, void *);
+    void *arg;
+};
+
+static void
+pfor_run(void *a)
+{
+    struct pfor *p = a;
+    struct pfor left, right;
+    struct task t;
+    int mid;
+
+    if(p->hi - p->lo <= p->grain){
+        p->body(p->lo, p->hi, p->arg);
+        return;
+    }
+    mid = p->lo + (p->hi - p->lo) / 2;
+    left = right = *p;
+    left.hi = mid;
+    right.lo = mid;
+    pool_async(&t, &pfor_run, &right);
+    pfor_run(&left);
+    pool_wait(&t);
+}
+
+void
+pool_parallel_for(int lo, int hi, int grain,
+                  void (*body)(int, int, void *), void *arg)
+{
+    struct pfor p;
+    int n = pool.n > 0 ? pool.n : 1;
+
+    if(hi <= lo)
+        return;
+    // worker stacks are one page, keep the split tree shallow
+    if(grain < (hi - lo) / (16 * n))
+        grain = (hi - lo) / (16 * n);
+    if(grain < 1)
+        grain = 1;
+    p.lo = lo;
+    p.hi = hi;
+    p.grain = grain;
+    p.body = body;
+    p.arg = arg;
+    pfor_run(&p);
+}
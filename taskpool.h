@@ -0,0 +1,30 @@
+// Work-stealing task pool on top of thread.h
+// One worker thread per CPU, each with its own Chase-Lev deque.
+// Idle workers steal from the others.
+
+struct task {
+    void (*fn)(void *);
+    void *arg;
+    volatile int done;
+};
+
+// start the pool with nworkers threads, 0 means one per CPU
+// returns number of workers started, -1 on failure
+int pool_start(int nworkers);
+
+// stop workers and join them, pending tasks must be waited first
+void pool_stop(void);
+
+// number of running workers
+int pool_size(void);
+
+// run fn(arg) asynchronously, t is owned by caller until pool_wait
+void pool_async(struct task *t, void (*fn)(void *), void *arg);
+
+// wait for t to be done, runs other tasks meanwhile
+void pool_wait(struct task *t);
+
+// calls body(lo, hi, arg) on chunks of [lo, hi) of at most grain
+// elements in parallel, returns when all chunks are done
+void pool_parallel_for(int lo, int hi, int grain,
+                       void (*body)(int, int, void *), void *arg);
@@ -1,6 +1,7 @@
 #include "thread.h"
 #include "types.h"
 #include "user.h"
+#include "atomic.h"
 
 #define PGSIZE 4096
 
@@ -57,6 +58,15 @@ thread_joiner(int tid)
     return res;
 }
 
+// waits for any thread created by caller to be done
+// returns its thread id, or -1 if there is none
+int
+thread_joiner_any(void)
+{
+    int res = thread_join_any();
+    return res;
+}
+
 // returns thread ID
 int 
 get_tid(void)
@@ -68,11 +78,13 @@ get_tid(void)
 // lock resources if you need them
 // you have to wait untill they are relaesed!
 void thread_mutex_lock(mutex_t * mutex){
-    while(mutex->lock == 1);
-    mutex->lock = 1;
+    // test and set must be one atomic step, or two
+    // threads can both see it free and take it
+    while(atomic_xchg((volatile uint *)&mutex->lock, 1) != 0)
+        atomic_pause();
 }
 
 // Unlock resources
 void thread_mutex_unlock(mutex_t * mutex){
-    mutex->lock = 0;
+    atomic_xchg((volatile uint *)&mutex->lock, 0);
 }
@@ -16,6 +16,10 @@ int thread_creator(void (*fn) (void *), void *arg);
 // waits for thread id to be done
 int thread_joiner(int tid);
 
+// waits for any thread created by caller to be done
+// returns its thread id, or -1 if there is none
+int thread_joiner_any(void);
+
 // returns thread ID
 int get_tid(void);
 
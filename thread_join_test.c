@@ -0,0 +1,62 @@
+#include "types.h"
+#include "user.h"
+#include "thread.h"
+
+// Checks thread_joiner() on a specific thread and
+// thread_joiner_any() on whatever exits next.
+
+#define NTHREADS 8
+
+int done[NTHREADS];
+
+void worker(void *arg)
+{
+    int i = (int)arg;
+    // later threads finish first, so joins by tid wait on
+    // threads that exit after others have already exited
+    sleep(NTHREADS - i);
+    done[i] = 1;
+}
+
+int main(void)
+{
+    int tids[NTHREADS];
+    int i, tid, joined = 0;
+
+    for(i = 0; i < NTHREADS; i++){
+        tids[i] = thread_creator(&worker, (void *)i);
+        if(tids[i] < 0){
+            printf(1, "thread_join_test: create failed\n");
+            exit();
+        }
+    }
+    // first half by id
+    for(i = 0; i < NTHREADS / 2; i++){
+        if(thread_joiner(tids[i]) < 0 || !done[i]){
+            printf(1, "thread_join_test: join %d failed\n", tids[i]);
+            exit();
+        }
+        joined++;
+    }
+    // the rest in exit order
+    while((tid = thread_joiner_any()) > 0){
+        for(i = NTHREADS / 2; i < NTHREADS; i++)
+            if(tids[i] == tid && done[i])
+                break;
+        if(i == NTHREADS){
+            printf(1, "thread_join_test: join_any returned %d\n", tid);
+            exit();
+        }
+        joined++;
+    }
+    if(joined != NTHREADS){
+        printf(1, "thread_join_test: joined %d of %d\n", joined, NTHREADS);
+        exit();
+    }
+    if(thread_joiner(tids[0]) != -1){
+        printf(1, "thread_join_test: joined a thread twice\n");
+        exit();
+    }
+    printf(1, "thread_join_test: OK\n");
+    exit();
+}
@@ -0,0 +1,76 @@
+#include "types.h"
+#include "user.h"
+
+// Pages dropped from the address space must be dropped from the
+// TLB too, now that the kernel invalidates single pages rather
+// than flushing everything: a page freed by sbrk() must fault
+// at once, and read back zeroed when the heap grows over it
+// again; a page written after fork() must not show through to
+// the other side.
+
+#define PGSIZE 4096
+#define NPG 8
+
+void fail(char *why)
+{
+    printf(1, "tlb_test: %s failed\n", why);
+    exit();
+}
+
+int main(void)
+{
+    volatile char *p;
+    int pid, fd[2], i;
+    char c;
+
+    if((p = sbrk(NPG * PGSIZE)) == (char *)-1)
+        fail("sbrk");
+    for(i = 0; i < NPG; i++)
+        p[i * PGSIZE] = 'a' + i;
+
+    // Shrink by a page and touch it: the child must die.
+    if(pipe(fd) < 0 || (pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0){
+        close(fd[0]);
+        c = p[(NPG - 1) * PGSIZE];
+        sbrk(-PGSIZE);
+        c = p[(NPG - 1) * PGSIZE];
+        write(fd[1], &c, 1);
+        exit();
+    }
+    close(fd[1]);
+    if(read(fd[0], &c, 1) != 0)
+        fail("freed page");
+    close(fd[0]);
+    wait();
+
+    // Shrink and grow back: the page is new and zeroed.
+    if(sbrk(-PGSIZE) == (char *)-1 || sbrk(PGSIZE) == (char *)-1)
+        fail("sbrk again");
+    if(p[(NPG - 1) * PGSIZE] != 0)
+        fail("regrown page");
+
+    // fork() write-protects the pages the parent may still
+    // have writable in its TLB; its writes must not reach the
+    // child's copy.
+    if(pipe(fd) < 0 || (pid = fork()) < 0)
+        fail("fork");
+    if(pid == 0){
+        close(fd[1]);
+        if(read(fd[0], &c, 1) != 1)
+            fail("pipe");
+        for(i = 0; i < NPG - 1; i++)
+            if(p[i * PGSIZE] != 'a' + i)
+                fail("copy-on-write");
+        exit();
+    }
+    close(fd[0]);
+    for(i = 0; i < NPG - 1; i++)
+        p[i * PGSIZE] = 'A' + i;
+    write(fd[1], "x", 1);
+    close(fd[1]);
+    wait();
+    printf(1, "tlb_test: OK\n");
+    exit();
+}
@@ -0,0 +1,52 @@
+// Show how much memory the machine and each process use,
+// processes with the most resident memory first.
+//
+// usage: top [count]
+
+#include "types.h"
+#include "param.h"
+#include "user.h"
+#include "memstat.h"
+
+#define MAXSHOW 128
+#define KB(pages) ((pages) * 4)
+
+struct procmem procs[MAXSHOW];
+
+int
+main(int argc, char *argv[])
+{
+  struct sysmem sm;
+  struct procmem t;
+  int n, i, j, count;
+
+  count = argc > 1 ? atoi(argv[1]) : MAXSHOW;
+  if(sysmem(&sm) < 0){
+    printf(2, "top: sysmem failed\n");
+    exit();
+  }
+  printf(1, "mem:  %dK total, %dK used, %dK free\n", KB(sm.total),
+         KB(sm.total - sm.free), KB(sm.free));
+  printf(1, "swap: %dK total, %dK used, %dK free\n", KB(sm.swaptotal),
+         KB(sm.swaptotal - sm.swapfree), KB(sm.swapfree));
+  if(sm.nnode > 1)
+    for(i = 0; i < sm.nnode; i++)
+      printf(1, "node %d: %dK total, %dK free\n", i, KB(sm.nodetotal[i]),
+             KB(sm.nodefree[i]));
+
+  // Insertion sort by resident size.
+  for(n = 0; n < MAXSHOW && procmem(n, &t) == 0; n++){
+    for(j = n; j > 0 && procs[j-1].rss < t.rss; j--)
+      procs[j] = procs[j-1];
+    procs[j] = t;
+  }
+
+  printf(1, "\nPID\tSIZE\tRSS\tSWAP\tPT\tMINFLT\tMAJFLT\tNAME\n");
+  for(i = 0; i < n && i < count; i++){
+    printf(1, "%d\t%dK\t%dK\t%dK\t%dK\t%d\t%d\t%s\n", procs[i].pid,
+           procs[i].sz / 1024, KB(procs[i].rss), KB(procs[i].swapped),
+           KB(procs[i].ptpages), procs[i].minflt, procs[i].majflt,
+           procs[i].name);
+  }
+  exit();
+}
@@ -48,6 +48,10 @@ trap(struct trapframe *tf)
       exit();
     return;
   }
+  if(tf->trapno == T_DEVICE && (tf->cs&3) == DPL_USER){
+    fputrap();
+    return;
+  }
 
   switch(tf->trapno){
   //processes come here every tick (10 million bus clocks)
@@ -84,6 +88,17 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_TLBFLUSH:
+    tlbpoll();
+    lapiceoi();
+    break;
+
+  case T_PGFLT:
+    if(myproc() && pgfault(myproc(), rcr2(), tf->err) == 0)
+      break;
+    // Not ours to fix, treat it like any other trap.
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
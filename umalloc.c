@@ -2,89 +2,301 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "atomic.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator, safe to use from threads (thread.h).
+//
+// Small requests (up to MAXSMALL bytes with the header) come from
+// segregated size classes. Each class has a free list in every one
+// of NCACHES caches; a thread uses the cache picked by hashing its
+// stack page, so threads mostly touch only their own cache lock.
+// Caches trade blocks in batches with a central list per class,
+// which is refilled by cutting CHUNK bytes from the large allocator.
+// Small allocation and free are O(1).
+//
+// Large requests use an address-ordered first-fit list with
+// coalescing, after Kernighan and Ritchie, The C Programming
+// Language, 2nd ed., Section 8.7. A free block of at least
+// TRIMSIZE bytes at the top of the heap is given back with a
+// negative sbrk, so nothing else may move the break while
+// threads use malloc. Requests of HUGESIZE or more get their
+// memory from sbrkhuge(), so that the kernel maps them with
+// 4 MB pages.
 
-typedef long Align;
+#define NCLASS 16
+#define MAXSMALL 4096        // largest small block, header included
+#define NCACHES 8
+#define CHUNK 16384          // bytes cut into small blocks at a time
+#define CACHEMAX 64          // free blocks per class a cache keeps
+#define MORECORE 32768       // least bytes asked from sbrk
+#define TRIMSIZE 131072      // free heap top given back to the kernel
+#define HUGESIZE 4194304     // SPGSIZE in mmu.h
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+// Precedes every block. Small blocks keep their class in size
+// with the SMALL bit set, large blocks their size in bytes.
+typedef struct header {
+  uint size;
+  struct header *next;       // free list link
+} Header;
+
+#define SMALL 1
+
+struct cache {
+  volatile uint lock;
+  Header *free[NCLASS];
+  int nfree[NCLASS];
 };
 
-typedef union header Header;
+static uint classsize[NCLASS] = {
+  16, 32, 48, 64, 96, 128, 192, 256,
+  384, 512, 768, 1024, 1536, 2048, 3072, 4096,
+};
 
-static Header base;
-static Header *freep;
+static struct {
+  volatile uint lock;        // protects everything below
+  volatile int inited;
+  uchar classof[MAXSMALL/16 + 1];  // size/16 rounded up -> class
+  Header *free[NCLASS];      // central lists
+  int nfree[NCLASS];
+  Header *large;             // large free blocks, by address
+} heap;
 
-void
-free(void *ap)
+static struct cache caches[NCACHES];
+
+static void
+lock(volatile uint *lk)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
+  while(atomic_xchg(lk, 1) != 0)
+    atomic_pause();
+}
+
+static void
+unlock(volatile uint *lk)
+{
+  atomic_xchg(lk, 0);
+}
+
+static void
+heapinit(void)
+{
+  int i, c;
+
+  lock(&heap.lock);
+  if(!heap.inited){
+    for(i = 0, c = 0; i <= MAXSMALL/16; i++){
+      while(classsize[c] < i*16)
+        c++;
+      heap.classof[i] = c;
+    }
+    atomic_barrier();
+    heap.inited = 1;
+  }
+  unlock(&heap.lock);
+}
+
+// cache of the calling thread, threads have their own stacks
+static struct cache*
+mycache(void)
+{
+  uint pg = (uint)&pg >> 12;
+
+  return &caches[((pg * 2654435761u) >> 16) % NCACHES];
+}
+
+//PAGEBREAK!
+// Large blocks. Caller holds heap.lock.
+
+// Put h back on the large list, merging it with its neighbours.
+// If trim is set, a big free top of the heap goes back to the kernel.
+static void
+lfree(Header *h, int trim)
+{
+  Header **pp, **hp, **prevp, *p, *prev;
+
+  prev = 0;
+  prevp = 0;
+  for(pp = &heap.large; (p = *pp) != 0 && p < h; pp = &p->next){
+    prevp = pp;
+    prev = p;
+  }
+  if(p && (char*)h + h->size == (char*)p){
+    h->size += p->size;
+    h->next = p->next;
   } else
-    p->s.ptr = bp;
-  freep = p;
+    h->next = p;
+  if(prev && (char*)prev + prev->size == (char*)h){
+    prev->size += h->size;
+    prev->next = h->next;
+    h = prev;
+    hp = prevp;
+  } else {
+    *pp = h;
+    hp = pp;
+  }
+  if(trim && h->next == 0 && h->size >= TRIMSIZE &&
+     (char*)h + h->size == sbrk(0)){
+    *hp = 0;
+    sbrk(-h->size);
+  }
 }
 
-static Header*
-morecore(uint nu)
+static int
+morecore(uint size)
 {
   char *p;
-  Header *hp;
+  uint pad;
+  Header *h;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
+  if(size < MORECORE)
+    size = MORECORE;
+  if(size >= HUGESIZE){
+    size = (size + HUGESIZE - 1) & ~(HUGESIZE - 1);
+    p = sbrkhuge(size);
+  } else
+    p = sbrk(size);
   if(p == (char*)-1)
-    return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+    return -1;
+  // the break is only 8-byte aligned if every sbrk was
+  pad = -(uint)p & 7;
+  h = (Header*)(p + pad);
+  h->size = (size - pad) & ~7;
+  lfree(h, 0);
+  return 0;
 }
 
-void*
-malloc(uint nbytes)
+// size includes the header and is a multiple of 8
+static Header*
+lalloc(uint size)
 {
-  Header *p, *prevp;
-  uint nunits;
+  Header **pp, *p;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
+  for(;;){
+    for(pp = &heap.large; (p = *pp) != 0; pp = &p->next){
+      if(p->size < size)
+        continue;
+      if(p->size - size >= 2*sizeof(Header)){
+        // hand out the tail, the list link stays put
+        p->size -= size;
+        p = (Header*)((char*)p + p->size);
+        p->size = size;
+      } else
+        *pp = p->next;
+      return p;
+    }
+    if(morecore(size) < 0)
+      return 0;
   }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
+}
+
+//PAGEBREAK!
+// Small blocks.
+
+// Move blocks of class c from the central list into cc, cutting
+// a new chunk if it is empty. Caller holds cc->lock.
+static void
+refill(struct cache *cc, int c)
+{
+  Header *h;
+  char *p, *end;
+
+  lock(&heap.lock);
+  if(heap.free[c] == 0){
+    if((h = lalloc(CHUNK)) != 0){
+      // the chunk is never freed, its header becomes a block too
+      end = (char*)h + CHUNK - classsize[c];
+      for(p = (char*)h; p <= end; p += classsize[c]){
+        h = (Header*)p;
+        h->size = c << 1 | SMALL;
+        h->next = heap.free[c];
+        heap.free[c] = h;
+        heap.nfree[c]++;
       }
-      freep = prevp;
-      return (void*)(p + 1);
     }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
   }
+  while(heap.free[c] && cc->nfree[c] < CACHEMAX/2){
+    h = heap.free[c];
+    heap.free[c] = h->next;
+    heap.nfree[c]--;
+    h->next = cc->free[c];
+    cc->free[c] = h;
+    cc->nfree[c]++;
+  }
+  unlock(&heap.lock);
+}
+
+// Give half of cc's blocks of class c back to the central list.
+// Caller holds cc->lock.
+static void
+drain(struct cache *cc, int c)
+{
+  Header *h;
+
+  lock(&heap.lock);
+  while(cc->nfree[c] > CACHEMAX/2){
+    h = cc->free[c];
+    cc->free[c] = h->next;
+    cc->nfree[c]--;
+    h->next = heap.free[c];
+    heap.free[c] = h;
+    heap.nfree[c]++;
+  }
+  unlock(&heap.lock);
+}
+
+void
+free(void *ap)
+{
+  Header *h;
+  struct cache *cc;
+  int c;
+
+  if(ap == 0)
+    return;
+  h = (Header*)ap - 1;
+  if(h->size & SMALL){
+    c = h->size >> 1;
+    cc = mycache();
+    lock(&cc->lock);
+    h->next = cc->free[c];
+    cc->free[c] = h;
+    if(++cc->nfree[c] > CACHEMAX)
+      drain(cc, c);
+    unlock(&cc->lock);
+    return;
+  }
+  lock(&heap.lock);
+  lfree(h, 1);
+  unlock(&heap.lock);
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *h;
+  struct cache *cc;
+  uint size;
+  int c;
+
+  if(!heap.inited)
+    heapinit();
+  if(nbytes >= 0x80000000 - sizeof(Header))
+    return 0;
+  size = (nbytes + sizeof(Header) + 7) & ~7;
+  if(size <= MAXSMALL){
+    c = heap.classof[(size + 15) / 16];
+    cc = mycache();
+    lock(&cc->lock);
+    if(cc->free[c] == 0)
+      refill(cc, c);
+    if((h = cc->free[c]) != 0){
+      cc->free[c] = h->next;
+      cc->nfree[c]--;
+    }
+    unlock(&cc->lock);
+    return h ? (void*)(h + 1) : 0;
+  }
+  lock(&heap.lock);
+  h = lalloc(size);
+  unlock(&heap.lock);
+  return h ? (void*)(h + 1) : 0;
 }
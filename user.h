@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct procmem;
+struct sysmem;
 
 // system calls
 int fork(void);
@@ -35,6 +37,21 @@ int set_priority(uint priority);
 int change_policy(int new_policy);
 int update_proc_timing(void);
 int get_proc_timing(void *ret);
+int thread_join_any(void);
+int getncpu(void);
+// Memory management:
+char* sbrkhuge(int);
+void* mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
+int msync(void*, uint);
+void* shmat(char*, uint);
+int shmdt(void*);
+int spawn(char*, char**, int*, int);
+int procmem(int, struct procmem*);
+int sysmem(struct sysmem*);
+int setmempolicy(int, int);
+int snapshot(int);
+int restore(char*);
 
 // ulib.c
 int stat(const char*, struct stat*);
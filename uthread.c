@@ -0,0 +1,262 @@
+#include "types.h"
+#include "user.h"
+#include "atomic.h"
+#include "thread.h"
+#include "uthread.h"
+
+// M:N user-level threads.
+// Each uthread has a UTHREAD_STACKSIZE stack aligned to its size,
+// with its struct uthread at the bottom, so the running uthread is
+// found from %esp. Carriers take uthreads from one shared FIFO run
+// queue and uswtch() into them; a uthread uswtch()es back to its
+// carrier to yield or finish.
+
+#define MAXCARRIERS 8        // NCPU in param.h
+#define STACKCHUNK 16        // stacks taken from malloc at a time
+#define IDLESPINS 2000       // empty polls before sleeping a tick
+#define UT_MAGIC 0x75746872
+
+// Registers saved by uswtch(), at the top of a switched-out stack.
+struct ucontext {
+    uint edi;
+    uint esi;
+    uint ebx;
+    uint ebp;
+    uint eip;
+};
+
+enum ustate { UT_RUNNABLE, UT_RUNNING, UT_DONE };
+
+struct carrier;
+
+// Lives at the bottom of the uthread's own stack.
+struct uthread {
+    uint magic;
+    int id;
+    volatile enum ustate state;
+    struct ucontext *ctx;      // saved registers while switched out
+    struct carrier *carrier;   // carrier running it
+    void (*fn)(void *);
+    void *arg;
+    struct uthread *next;      // run queue or free list
+};
+
+struct carrier {
+    struct ucontext *sched;    // uswtch() here to leave a uthread
+    int tid;
+};
+
+static struct {
+    volatile uint lock;        // protects everything below
+    struct uthread *head;      // run queue
+    struct uthread *tail;
+    struct uthread *free;      // stacks of finished uthreads
+    int nextid;
+    volatile int nlive;        // spawned and not yet done
+    struct carrier carriers[MAXCARRIERS];
+} ut;
+
+void uswtch(struct ucontext **old, struct ucontext *new);
+
+static void
+lock(void)
+{
+    while(atomic_xchg(&ut.lock, 1) != 0)
+        atomic_pause();
+}
+
+static void
+unlock(void)
+{
+    atomic_xchg(&ut.lock, 0);
+}
+
+// caller holds ut.lock
+static void
+enqueue(struct uthread *t)
+{
+    t->next = 0;
+    if(ut.tail)
+        ut.tail->next = t;
+    else
+        ut.head = t;
+    ut.tail = t;
+}
+
+// caller holds ut.lock
+static struct uthread*
+stackalloc(void)
+{
+    struct uthread *t;
+    char *p, *s;
+    int i;
+
+    if(ut.free == 0){
+        // one stack of slack to align the chunk
+        p = malloc((STACKCHUNK + 1) * UTHREAD_STACKSIZE);
+        if(p == 0)
+            return 0;
+        s = (char*)(((uint)p + UTHREAD_STACKSIZE - 1) &
+                    ~(UTHREAD_STACKSIZE - 1));
+        for(i = 0; i < STACKCHUNK; i++){
+            t = (struct uthread*)(s + i * UTHREAD_STACKSIZE);
+            t->magic = 0;
+            t->next = ut.free;
+            ut.free = t;
+        }
+    }
+    t = ut.free;
+    ut.free = t->next;
+    return t;
+}
+
+// uthread running on the caller's stack, 0 if none
+static struct uthread*
+self(void)
+{
+    uint sp;
+    struct uthread *t;
+
+    asm volatile("movl %%esp, %0" : "=r" (sp));
+    t = (struct uthread*)(sp & ~(UTHREAD_STACKSIZE - 1));
+    if(t->magic != UT_MAGIC)
+        return 0;
+    return t;
+}
+
+// first code run by a new uthread, see uthread_spawn
+static void
+ustart(void)
+{
+    struct uthread *t = self();
+
+    t->fn(t->arg);
+    uthread_exit();
+}
+
+int
+uthread_spawn(void (*fn)(void *), void *arg)
+{
+    struct uthread *t;
+    uint *sp;
+    int id;
+
+    lock();
+    if((t = stackalloc()) == 0){
+        unlock();
+        return -1;
+    }
+    t->magic = UT_MAGIC;
+    t->id = id = ++ut.nextid;
+    t->state = UT_RUNNABLE;
+    t->carrier = 0;
+    t->fn = fn;
+    t->arg = arg;
+    // uswtch() pops this context and returns into ustart
+    sp = (uint*)((char*)t + UTHREAD_STACKSIZE);
+    *--sp = 0;  // fake return PC of ustart
+    sp -= sizeof(struct ucontext) / sizeof(uint);
+    t->ctx = (struct ucontext*)sp;
+    memset(t->ctx, 0, sizeof(*t->ctx));
+    t->ctx->eip = (uint)ustart;
+    ut.nlive++;
+    enqueue(t);
+    unlock();
+    return id;
+}
+
+static void
+carrierloop(struct carrier *c)
+{
+    struct uthread *t;
+    int idle = 0;
+
+    while(ut.nlive > 0){
+        lock();
+        if((t = ut.head) != 0){
+            ut.head = t->next;
+            if(ut.head == 0)
+                ut.tail = 0;
+        }
+        unlock();
+        if(t == 0){
+            if(++idle >= IDLESPINS){
+                sleep(1);
+                idle = 0;
+            }
+            continue;
+        }
+        idle = 0;
+        t->state = UT_RUNNING;
+        t->carrier = c;
+        uswtch(&c->sched, t->ctx);
+        // t yielded or finished, its registers are saved now
+        lock();
+        if(t->state == UT_DONE){
+            t->magic = 0;
+            t->next = ut.free;
+            ut.free = t;
+            ut.nlive--;
+        } else {
+            t->state = UT_RUNNABLE;
+            enqueue(t);
+        }
+        unlock();
+    }
+}
+
+static void
+carrierthread(void *arg)
+{
+    carrierloop(&ut.carriers[(int)arg]);
+}
+
+int
+uthread_run(int ncarriers)
+{
+    int i, n;
+
+    if(ncarriers <= 0)
+        ncarriers = getncpu();
+    if(ncarriers > MAXCARRIERS)
+        ncarriers = MAXCARRIERS;
+    // carrier 0 is the caller
+    for(n = 1; n < ncarriers; n++)
+        if((ut.carriers[n].tid = thread_creator(&carrierthread, (void *)n)) < 0)
+            break;
+    carrierloop(&ut.carriers[0]);
+    for(i = 1; i < n; i++)
+        thread_joiner(ut.carriers[i].tid);
+    return n;
+}
+
+void
+uthread_yield(void)
+{
+    struct uthread *t = self();
+
+    if(t == 0)
+        return;
+    uswtch(&t->ctx, t->carrier->sched);
+}
+
+void
+uthread_exit(void)
+{
+    struct uthread *t = self();
+
+    if(t == 0)
+        exit();
+    t->state = UT_DONE;
+    uswtch(&t->ctx, t->carrier->sched);
+    for(;;)
+        ;  // not reached, the carrier frees this stack
+}
+
+int
+uthread_self(void)
+{
+    struct uthread *t = self();
+
+    return t ? t->id : -1;
+}
@@ -0,0 +1,24 @@
+// M:N user-level threads
+// Many cooperative uthreads run on a few carrier kernel threads
+// (thread.h). Switching between uthreads never enters the kernel.
+
+// stack of each uthread, the uthread struct lives at its bottom
+#define UTHREAD_STACKSIZE 4096
+
+// create a uthread running fn(arg), may be called before
+// uthread_run() or from inside a uthread
+// returns its id, -1 on failure
+int uthread_spawn(void (*fn)(void *), void *arg);
+
+// run uthreads on ncarriers kernel threads (0 means one per CPU),
+// the caller is one of them. returns when all uthreads are done
+int uthread_run(int ncarriers);
+
+// give the carrier to another runnable uthread
+void uthread_yield(void);
+
+// finish the calling uthread, returning from fn does the same
+void uthread_exit(void) __attribute__((noreturn));
+
+// id of the calling uthread, -1 outside of uthreads
+int uthread_self(void);
@@ -0,0 +1,53 @@
+#include "types.h"
+#include "user.h"
+#include "uthread.h"
+
+// Runs many uthreads that yield to each other on a few carriers.
+// usage: uthread_test [nthreads] [yields]
+
+#define MAXN 20000
+
+int counts[MAXN];
+int yields = 10;
+
+void
+route(void *arg)
+{
+    int i;
+
+    for(i = 0; i < yields; i++){
+        counts[(int)arg]++;
+        uthread_yield();
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    int n = 10000, i, t, sum = 0;
+
+    if(argc > 1)
+        n = atoi(argv[1]);
+    if(argc > 2)
+        yields = atoi(argv[2]);
+    if(n > MAXN)
+        n = MAXN;
+    for(i = 0; i < n; i++){
+        if(uthread_spawn(&route, (void *)i) < 0){
+            printf(1, "uthread_test: spawn %d failed\n", i);
+            exit();
+        }
+    }
+    t = uptime();
+    i = uthread_run(0);
+    t = uptime() - t;
+    for(i = 0; i < n; i++)
+        sum += counts[i];
+    if(sum != n * yields){
+        printf(1, "uthread_test: %d of %d increments\n", sum, n * yields);
+        exit();
+    }
+    printf(1, "uthread_test: %d uthreads, %d switches in %d ticks OK\n",
+           n, n * (yields + 1), t);
+    exit();
+}
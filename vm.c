@@ -6,10 +6,37 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+#include "traps.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+#define SPGORDER 10  // a superpage is a block of 2^10 pages
+#define SWAPSLOT(pte) ((uint)(pte) >> PTXSHIFT)  // of a PTE_SWAP entry
+#define TLBMAXPG 32  // pages flushpages() invalidates one at a time
+#define SPGRESERVE (4 << SPGORDER)  // free pages superfill() leaves
+
+// Serializes page fault handling and copy-on-write sharing,
+// so that threads sharing a page table do not fill or copy
+// a page twice, and no page is made writable while fork()
+// is sharing it.
+static struct spinlock vmlock;
+
+// The TLB shootdown in progress, see flushpages(). The lock
+// lets one CPU at a time ask the others to flush.
+static struct {
+  struct spinlock lock;
+  pde_t *pgdir;
+  uint va;
+  uint len;
+} shoot;
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -31,7 +58,9 @@ seginit(void)
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page table pages.
+// create any required page table pages. If va lies in a
+// superpage, return its page directory entry, which has
+// PTE_PS set.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,13 +68,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return pde;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -56,7 +86,8 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned.
+// be page-aligned. If perm has PTE_PS, superpages are used
+// wherever va and pa are both 4 MB aligned.
 static int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 {
@@ -66,11 +97,23 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   a = (char*)PGROUNDDOWN((uint)va);
   last = (char*)PGROUNDDOWN(((uint)va) + size - 1);
   for(;;){
+    if((perm & PTE_PS) && (uint)a % SPGSIZE == 0 && pa % SPGSIZE == 0 &&
+       last - a >= SPGSIZE - PGSIZE){
+      pte = &pgdir[PDX(a)];
+      if(*pte & PTE_P)
+        panic("remap");
+      *pte = pa | perm | PTE_P;
+      if(last - a == SPGSIZE - PGSIZE)
+        break;
+      a += SPGSIZE;
+      pa += SPGSIZE;
+      continue;
+    }
     if((pte = walkpgdir(pgdir, a, 1)) == 0)
       return -1;
     if(*pte & PTE_P)
       panic("remap");
-    *pte = pa | perm | PTE_P;
+    *pte = pa | (perm & ~PTE_PS) | PTE_P;
     if(a == last)
       break;
     a += PGSIZE;
@@ -92,16 +135,19 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, found
+// at boot by kinit1) (directly addressable from end..P2V(phystop)).
 
 // This table defines the kernel's mappings, which are present in
-// every process's page table.
+// every process's page table. kvmalloc() fills in the end of
+// physical memory. Entries with PTE_PS use superpages where
+// they can, so that mapping all of memory into each process
+// takes a few page table pages rather than one per 4 MB.
 static struct kmap {
   void *virt;
   uint phys_start;
@@ -110,8 +156,8 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
- { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
+ { (void*)data,     V2P(data),     0,         PTE_W|PTE_PS}, // kern data+memory
+ { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W|PTE_PS}, // more devices
 };
 
 // Set up kernel part of a page table.
@@ -121,11 +167,10 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
+  if (P2V(phystop) > (void*)DEVSPACE)
+    panic("phystop too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
     if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
                 (uint)k->phys_start, k->perm) < 0) {
@@ -140,8 +185,32 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
+  initlock(&vmlock, "vm");
+  initlock(&shoot.lock, "shootdown");
+  kmap[2].phys_end = phystop;
   kpgdir = setupkvm();
-  switchkvm();
+  lcr3(V2P(kpgdir));  // no cpus[] for switchkvm() yet
+}
+
+// Map the n bytes of firmware tables at physical address pa
+// into the kernel page table at P2V(pa), for acpiinit(). They
+// are in reserved memory that the kernel's own mappings may
+// not cover. Returns 0 if pa is too high to be mapped.
+void*
+kmapfirmware(uint pa, uint n)
+{
+  pte_t *pte;
+  uint a;
+
+  if(pa + n < pa || pa + n > MAXPHYS)
+    return 0;
+  for(a = PGROUNDDOWN(pa); a < pa + n; a += PGSIZE){
+    if((pte = walkpgdir(kpgdir, P2V(a), 1)) == 0)
+      return 0;
+    if(!(*pte & PTE_P))
+      *pte = a | PTE_P;
+  }
+  return P2V(pa);
 }
 
 // Switch h/w page table register to the kernel-only page table,
@@ -149,7 +218,10 @@ kvmalloc(void)
 void
 switchkvm(void)
 {
+  pushcli();
   lcr3(V2P(kpgdir));   // switch to the kernel page table
+  mycpu()->pgdir = kpgdir;
+  popcli();
 }
 
 // Switch TSS and h/w page table to correspond to process p.
@@ -173,6 +245,9 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  // Set before loading, so that flushpages() cannot miss
+  // this CPU; lcr3 orders the two.
+  mycpu()->pgdir = p->pgdir;
   lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
@@ -186,58 +261,33 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// May push pages out to swap, so the caller must not hold a spinlock.
 int
 allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > KERNBASE)
     return 0;
   if(newsz < oldsz)
     return oldsz;
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzallocswap(1);
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,33 +298,92 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Replace the superpage at va with a page table that maps the
+// same pages, so that they can be shared, copied and freed one
+// at a time. Returns -1 if there is no memory for the table.
+static int
+splitsuper(pde_t *pgdir, uint va)
+{
+  pde_t *pde;
+  pte_t *pgtab;
+  uint pa, flags, i;
+
+  pde = &pgdir[PDX(va)];
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  pa = PTE_ADDR(*pde);
+  flags = PTE_FLAGS(*pde) & ~PTE_PS;
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (pa + i*PGSIZE) | flags;
+  ksplitpages(P2V(pa), SPGORDER);
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size.  Pages are only
+// freed once no CPU's TLB maps them any more.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  char *freed[TLBMAXPG];
   pte_t *pte;
-  uint a, pa;
+  uint a, pa, lo, hi;
+  int n;
 
   if(newsz >= oldsz)
     return oldsz;
 
+  n = 0;
+  lo = hi = 0;
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
     pte = walkpgdir(pgdir, (char*)a, 0);
-    if(!pte)
+    if(pte && (*pte & PTE_PS)){
+      if(a % SPGSIZE == 0 && a + SPGSIZE <= oldsz){
+        pa = PTE_ADDR(*pte);
+        *pte = 0;
+        flushpages(pgdir, a, SPGSIZE);
+        kfreepages(P2V(pa), SPGORDER);
+        a += SPGSIZE - PGSIZE;
+        continue;
+      }
+      if(splitsuper(pgdir, a) < 0){
+        // Out of memory: keep the rest of the superpage.
+        a = SPGROUNDDOWN(a) + SPGSIZE - PGSIZE;
+        continue;
+      }
+      pte = walkpgdir(pgdir, (char*)a, 0);
+    }
+    if(!pte){
+      pgdir[PDX(a)] = 0;  // no longer all sbrkhuge() memory
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if((*pte & PTE_P) != 0){
+    } else if((*pte & PTE_P) != 0){
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
+      *pte = 0;
+      if(n == 0)
+        lo = a;
+      freed[n++] = P2V(pa);
+      hi = a + PGSIZE;
+      if(n == TLBMAXPG){
+        flushpages(pgdir, lo, hi - lo);
+        while(n > 0)
+          kfree(freed[--n]);
+      }
+    } else if(*pte & PTE_SWAP){
+      swapfree(SWAPSLOT(*pte));
       *pte = 0;
     }
   }
+  if(n > 0){
+    flushpages(pgdir, lo, hi - lo);
+    while(n > 0)
+      kfree(freed[--n]);
+  }
   return newsz;
 }
 
@@ -289,7 +398,7 @@ freevm(pde_t *pgdir)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+    if((pgdir[i] & PTE_P) && !(pgdir[i] & PTE_PS)){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -297,50 +406,939 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
-// Clear PTE_U on a page. Used to create an inaccessible
-// page beneath the user stack.
+// Drop this CPU's TLB entries for the pages of [va, va+len)
+// of pgdir, the page table it has loaded. A few pages are
+// invalidated one at a time with invlpg, so that the rest of
+// the TLB survives; past TLBMAXPG pages reloading cr3 to flush
+// it all is cheaper.
+static void
+tlbflush(pde_t *pgdir, uint va, uint len)
+{
+  uint a, end;
+
+  a = PGROUNDDOWN(va);
+  end = PGROUNDUP(va + len);
+  if((end - a) / PGSIZE > TLBMAXPG){
+    lcr3(V2P(pgdir));
+    return;
+  }
+  for(; a < end; a += PGSIZE)
+    invlpg((void*)a);
+}
+
+// Drop the TLB entries for the pages of [va, va+len) of pgdir
+// on every CPU that has it loaded. Other CPUs are sent a
+// T_TLBFLUSH interrupt, and waited for, so that on return no
+// CPU can still use the old entries.
 void
-clearpteu(pde_t *pgdir, char *uva)
+flushpages(pde_t *pgdir, uint va, uint len)
 {
-  pte_t *pte;
+  struct cpu *me, *c;
 
-  pte = walkpgdir(pgdir, uva, 0);
-  if(pte == 0)
-    panic("clearpteu");
-  *pte &= ~PTE_U;
+  if(len == 0)
+    return;
+  pushcli();
+  me = mycpu();
+  if(me->pgdir == pgdir)
+    tlbflush(pgdir, va, len);
+  // Order the caller's page table changes before the loads
+  // of c->pgdir; switchuvm() orders them the other way.
+  __sync_synchronize();
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c != me && c->pgdir == pgdir)
+      break;
+  if(c == cpus+ncpu){
+    popcli();
+    return;
+  }
+  acquire(&shoot.lock);
+  shoot.pgdir = pgdir;
+  shoot.va = va;
+  shoot.len = len;
+  __sync_synchronize();
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c == me || c->pgdir != pgdir)
+      continue;
+    c->tlbpending = 1;
+    lapicipi(c->apicid, T_TLBFLUSH);
+  }
+  for(c = cpus; c < cpus+ncpu; c++)
+    while(c->tlbpending)
+      ;
+  release(&shoot.lock);
+  popcli();
+}
+
+// Do the flush flushpages() asked this CPU for, if any.
+// Called with interrupts off, by the T_TLBFLUSH handler and
+// by acquire() while it spins, as the sender may hold the lock.
+void
+tlbpoll(void)
+{
+  struct cpu *c = mycpu();
+
+  if(!c->tlbpending)
+    return;
+  __sync_synchronize();
+  if(c->pgdir == shoot.pgdir)
+    tlbflush(shoot.pgdir, shoot.va, shoot.len);
+  c->tlbpending = 0;
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. Pages are shared, not copied: writable
+// ones become read-only with PTE_COW set in both tables, and
+// the first write to one on either side copies it. Pages
+// of MAP_SHARED regions (PTE_SHARED) stay writable and shared.
+// Swapped out pages are shared in swap: each side reads its own
+// copy back. The parent's superpages are split first, so that
+// this works a page at a time.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
+  pte_t *pte, *cpte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
+  acquire(&vmlock);
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      d[PDX(i)] = pgdir[PDX(i)] & PTE_HUGE;
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_PS){
+      if(splitsuper(pgdir, i) < 0)
+        goto bad;
+      pte = walkpgdir(pgdir, (void *) i, 0);
+    }
+    if(*pte & PTE_SWAP){
+      if((cpte = walkpgdir(d, (void *) i, 1)) == 0 ||
+         swapdup(SWAPSLOT(*pte)) < 0)
+        goto bad;
+      *cpte = *pte;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;  // not touched yet, see pgfault()
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if((flags & PTE_W) && !(flags & PTE_SHARED)){
+      flags = (flags & ~PTE_W) | PTE_COW;
+      *pte = pa | flags;
+    }
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
+    kref(P2V(pa));
+  }
+  release(&vmlock);
+  flushpages(pgdir, 0, sz);
+  return d;
+
+bad:
+  release(&vmlock);
+  flushpages(pgdir, 0, sz);
+  freevm(d);
+  return 0;
+}
+
+// Give pgdir a private writable copy of the copy-on-write
+// page at va, or just make it writable if no one else
+// shares it. Returns 0 on success, -1 if va is not a
+// copy-on-write page or memory ran out.
+static int
+cowcopy(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa, flags, old;
+  char *mem, *freed;
+
+  mem = 0;
+  freed = 0;
+  acquire(&vmlock);
+again:
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte == 0 || !(*pte & PTE_P) || !(*pte & (PTE_COW|PTE_W))){
+    release(&vmlock);
+    if(mem)
+      kfree(mem);
+    return pte && (*pte & PTE_SWAP) ? 0 : -1;
+  }
+  if(*pte & PTE_W){
+    // Another thread got here first.
+    release(&vmlock);
+    if(mem)
       kfree(mem);
+    return 0;
+  }
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(krefcount(P2V(pa)) > 1){
+    if(mem == 0){
+      // Allocating may push pages out to swap, which
+      // cannot be done holding vmlock.
+      old = *pte;
+      release(&vmlock);
+      if((mem = kallocswap(1)) == 0)
+        return -1;
+      acquire(&vmlock);
+      if(*pte != old)
+        goto again;
+    }
+    memmove(mem, P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    freed = P2V(pa);
+  } else {
+    *pte = pa | flags;
+    if(mem)
+      kfree(mem);
+  }
+  release(&vmlock);
+  flushpages(pgdir, va, PGSIZE);
+  if(freed)
+    kfree(freed);  // not before other CPUs stopped using it
+  return 0;
+}
+
+// Map a zeroed page at va with permissions perm, unless
+// another thread already did.
+static int
+zerofill(pde_t *pgdir, uint va, uint perm)
+{
+  pte_t *pte;
+  char *mem;
+
+  if((mem = kzallocswap(1)) == 0)
+    return -1;
+  acquire(&vmlock);
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_P)){
+    release(&vmlock);
+    kfree(mem);
+    return 0;
+  }
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    release(&vmlock);
+    return -1;
+  }
+  release(&vmlock);
+  return 0;
+}
+
+// Mark the untouched 4 MB spans of [start, end), just reserved
+// by sbrkhuge(), for superfill(). The mark lives in the page
+// directory entry, which is not present yet.
+void
+hugeuvm(pde_t *pgdir, uint start, uint end)
+{
+  uint a;
+
+  acquire(&vmlock);
+  for(a = SPGROUNDUP(start); a + SPGSIZE <= end; a += SPGSIZE)
+    if(pgdir[PDX(a)] == 0)
+      pgdir[PDX(a)] = PTE_HUGE;
+  release(&vmlock);
+}
+
+// Map a zeroed superpage over the 4 MB around va if it is an
+// untouched span of sbrkhuge() memory, so that a large heap
+// takes one TLB entry per 4 MB rather than 1024. Memory that
+// sbrk() gave is left to 4 KB pages: a sparsely touched array
+// should not cost 4 MB per touch. The last SPGRESERVE free pages
+// are left alone too, so that one touch does not push other
+// processes into reclaim(). Returns -1 if that cannot be done,
+// and the caller maps a page instead.
+static int
+superfill(struct proc *p, uint va)
+{
+  pde_t *pde;
+  char *mem;
+
+  va = SPGROUNDDOWN(va);
+  if(va + SPGSIZE > p->vmowner->sz || p->pgdir[PDX(va)] != PTE_HUGE)
+    return -1;
+  if(!vmafree(p, va, va + SPGSIZE) || knfree(-1) < SPGRESERVE)
+    return -1;
+  if((mem = kallocuserpages(SPGORDER)) == 0)
+    return -1;
+  memset(mem, 0, SPGSIZE);
+  acquire(&vmlock);
+  pde = &p->pgdir[PDX(va)];
+  if(*pde & PTE_P){
+    // Another thread touched this 4 MB meanwhile.
+    release(&vmlock);
+    kfreepages(mem, SPGORDER);
+    return -1;
+  }
+  *pde = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+  release(&vmlock);
+  return 0;
+}
+
+// Map the page at va of file-backed region v. Whole pages
+// of file data come from the page cache and are shared, a
+// writable private region gets them copy-on-write. A page
+// that is only partly file data is read into a private copy,
+// unless the region is shared: its filesz ends at the end of
+// the file, so the cached page, zero past it, is shared too.
+// Reads the inode, so the caller must not hold any spinlock.
+// Sets *read if the data was not cached and had to be read.
+static int
+filefill(pde_t *pgdir, struct vma *v, uint va, int *read)
+{
+  pte_t *pte;
+  uint pgoff, n, perm;
+  char *mem;
+
+  pgoff = va - v->start;
+  perm = PTE_U | (v->writable ? PTE_W : 0) | (v->shared ? PTE_SHARED : 0);
+  if(pgoff + PGSIZE <= v->filesz || (v->shared && pgoff < v->filesz)){
+    if((mem = pcacheget(v->ip, v->off + pgoff, read)) == 0)
+      return -1;
+    if(v->writable && !v->shared)
+      perm = PTE_U | PTE_COW;
+  } else {
+    if((mem = kzallocswap(1)) == 0)
+      return -1;
+    if(pgoff < v->filesz){
+      n = v->filesz - pgoff;
+      *read = 1;
+      ilock(v->ip);
+      if(readi(v->ip, mem, v->off + pgoff, n) != n){
+        iunlock(v->ip);
+        kfree(mem);
+        return -1;
+      }
+      iunlock(v->ip);
+    }
+  }
+
+  acquire(&vmlock);
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_P)){
+    // Another thread mapped it meanwhile.
+    release(&vmlock);
+    kfree(mem);
+    return 0;
+  }
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    release(&vmlock);
+    kfree(mem);
+    return -1;
+  }
+  release(&vmlock);
+  return 0;
+}
+
+// Read back the page at va that was pushed out to swap,
+// unless another thread already did.
+static int
+swapin(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint e;
+  char *mem;
+
+  acquire(&vmlock);
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte == 0 || !(*pte & PTE_SWAP)){
+    release(&vmlock);
+    return 0;
+  }
+  e = *pte;
+  if(swapdup(SWAPSLOT(e)) < 0){  // keep the slot while reading it
+    release(&vmlock);
+    return -1;
+  }
+  release(&vmlock);
+  if((mem = kallocswap(1)) == 0){
+    swapfree(SWAPSLOT(e));
+    return -1;
+  }
+  swapread(SWAPSLOT(e), mem);
+  acquire(&vmlock);
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte && *pte == e){
+    *pte = V2P(mem) | (PTE_FLAGS(e) & ~PTE_SWAP) | PTE_P;
+    swapfree(SWAPSLOT(e));
+    mem = 0;
+  }
+  release(&vmlock);
+  swapfree(SWAPSLOT(e));
+  if(mem)
+    kfree(mem);
+  return 0;
+}
+
+// Handle a page fault of p at user address va; err is the
+// error code the processor pushed. Returns 0 if the access
+// can be retried, -1 if it is a real fault. Sets *major if
+// the page was read from disk.
+static int
+fault(struct proc *p, uint va, uint err, int *major)
+{
+  struct vma *v;
+  pte_t *pte;
+
+  if(va >= KERNBASE)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_P)){
+    if((err & FEC_U) && !(*pte & PTE_U))
+      return -1;
+    if((err & FEC_WR) && (*pte & PTE_COW))
+      return cowcopy(p->pgdir, va);
+    return -1;
+  }
+  if(pte && (*pte & PTE_SWAP)){
+    *major = 1;
+    return swapin(p->pgdir, va);
+  }
+  for(v = p->vmowner->vma; v < &p->vmowner->vma[NVMA]; v++){
+    if(v->end == 0 || va < v->start || va >= v->end)
+      continue;
+    if(v->shm)
+      return -1;  // mapped by shmat(), never paged
+    if(v->stack && va < v->start + PGSIZE)
+      return -1;  // stack overflow
+    if(v->ip)
+      return filefill(p->pgdir, v, va, major);
+    return zerofill(p->pgdir, va, PTE_U | (v->writable ? PTE_W : 0) |
+                    (v->shared ? PTE_SHARED : 0));
+  }
+  // Memory below sz that was never touched, see growproc().
+  if(va < p->vmowner->sz){
+    if(superfill(p, va) == 0)
+      return 0;
+    return zerofill(p->pgdir, va, PTE_W|PTE_U);
+  }
+  return -1;
+}
+
+// Handle a page fault as fault() does, counting it in p's
+// statistics if it was handled.
+int
+pgfault(struct proc *p, uint va, uint err)
+{
+  int major;
+
+  major = 0;
+  if(fault(p, va, err, &major) < 0)
+    return -1;
+  if(major)
+    p->majflt++;
+  else
+    p->minflt++;
+  return 0;
+}
+
+// Count the user memory of pgdir: resident pages in *rss,
+// pages out in swap in *swapped, and page table pages, the
+// directory included, in *ptpages.
+void
+uvmstat(pde_t *pgdir, uint *rss, uint *swapped, uint *ptpages)
+{
+  pte_t *pgtab;
+  uint i, j;
+
+  *rss = *swapped = 0;
+  *ptpages = 1;
+  acquire(&vmlock);
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!(pgdir[i] & PTE_P))
+      continue;
+    if(pgdir[i] & PTE_PS){
+      *rss += NPTENTRIES;
+      continue;
+    }
+    (*ptpages)++;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(pgtab[j] & PTE_P)
+        (*rss)++;
+      else if(pgtab[j] & PTE_SWAP)
+        (*swapped)++;
+    }
+  }
+  release(&vmlock);
+}
+
+// Fault in the pages of [va, va+n) that p has not touched yet,
+// so that the kernel can use them while holding a spinlock,
+// as consolewrite() and the pipe code do. They are pinned
+// until the system call returns, so that reclaim() does not
+// push them out to swap meanwhile; see pinned(). If the kernel
+// is to write them, copy-on-write pages are copied now, and
+// read-only ones fail: a kernel write to one would panic.
+int
+prefault(struct proc *p, uint va, uint n, int write)
+{
+  pte_t *pte;
+  uint a;
+
+  if(n == 0)
+    return 0;
+  acquire(&vmlock);
+  if(p->pinlo == p->pinhi){
+    p->pinlo = va;
+    p->pinhi = va + n;
+  } else {
+    if(va < p->pinlo)
+      p->pinlo = va;
+    if(va + n > p->pinhi)
+      p->pinhi = va + n;
+  }
+  release(&vmlock);
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+again:
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || !(*pte & PTE_P)){
+      if(pgfault(p, a, 0) < 0)
+        return -1;
+      if(write)
+        goto again;
+    } else if(write && !(*pte & PTE_W)){
+      if(!(*pte & PTE_COW) || pgfault(p, a, FEC_PR|FEC_WR) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Give np a copy of the regions of p, with references
+// to their files.
+void
+vmadup(struct proc *np, struct proc *p)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = p->vmowner->vma[i];
+    if(np->vma[i].ip)
+      idup(np->vma[i].ip);
+    if(np->vma[i].shm)
+      shmdup(np->vma[i].shm);
+  }
+}
+
+// Drop p's regions. Caller must be in a file system
+// transaction, as for iput().
+void
+vmaput(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip)
+      iput(v->ip);
+    if(v->shm)
+      shmput(v->shm);
+    memset(v, 0, sizeof(*v));
+  }
+}
+
+// Return 1 if none of p's regions overlaps [start, end).
+int
+vmafree(struct proc *p, uint start, uint end)
+{
+  struct vma *v;
+
+  for(v = p->vmowner->vma; v < &p->vmowner->vma[NVMA]; v++)
+    if(v->end && v->start < end && v->end > start)
+      return 0;
+  return 1;
+}
+
+// Return the end of the user memory of p that addr is in,
+// the heap or a region and any regions right after it, or 0
+// if addr is not valid. The guard page at the bottom of the
+// stack is not valid.
+uint
+uend(struct proc *p, uint addr)
+{
+  struct vma *v, *vma;
+  uint end;
+
+  if(addr < p->vmowner->sz)
+    return p->vmowner->sz;
+  vma = p->vmowner->vma;
+  for(v = vma; v < &vma[NVMA]; v++)
+    if(v->end && addr >= v->start && addr < v->end)
+      break;
+  if(v == &vma[NVMA] || (v->stack && addr < v->start + PGSIZE))
+    return 0;
+  end = v->end;
+again:
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->end && v->start == end){
+      end = v->end;
+      goto again;
+    }
+  }
+  return end;
+}
+
+// Return 1 if the page at va of pgdir is in use: mapped,
+// or pushed out to swap.
+int
+uvmused(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  return pte && (*pte & (PTE_P|PTE_SWAP));
+}
+
+// Look for pages of pgdir to push out to swap, from *va up
+// to KERNBASE, for the clock algorithm of reclaim(): a page
+// used since the hand last passed it (PTE_A) gets a second
+// chance, one that was not is queued with swapqueue(). Only
+// private pages that no one else maps qualify: not shared or
+// copy-on-write ones, nor the page cache's. Cold superpages
+// are split first. Stops when n pages are queued or swap is
+// full, leaving *va where it stopped, and returns the number
+// queued. The caller holds the ptable lock, no one holds
+// growlock() on pgdir, and no other CPU is using it.
+int
+swapscan(pde_t *pgdir, uint *va, int n)
+{
+  pde_t *pde;
+  pte_t *pte;
+  uint a, pa, start;
+  int got, slot;
+
+  got = 0;
+  start = *va;
+  acquire(&vmlock);
+  for(a = *va; a < KERNBASE && got < n; a += PGSIZE){
+    pde = &pgdir[PDX(a)];
+    if((*pde & PTE_PS) && (*pde & PTE_A)){
+      *pde &= ~PTE_A;
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pde & PTE_P) || ((*pde & PTE_PS) && splitsuper(pgdir, a) < 0)){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U) || (*pte & PTE_SHARED))
+      continue;
+    pa = PTE_ADDR(*pte);
+    if(krefcount(P2V(pa)) != 1)
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    if(pinned(pgdir, a))
+      continue;
+    if((slot = swapqueue(P2V(pa))) < 0)
+      break;
+    *pte = slot << PTXSHIFT | PTE_SWAP | (*pte & (PTE_W|PTE_U|PTE_COW));
+    got++;
+  }
+  *va = a;
+  release(&vmlock);
+  flushpages(pgdir, start, a - start);
+  return got;
+}
+
+//PAGEBREAK!
+// Memory-mapped files and anonymous memory. Regions live in
+// the vma[] of the process that owns the page table and are
+// changed under growlock(), like the size.
+
+// Find room for len bytes between the heap and KERNBASE,
+// as high as possible so that the heap can keep growing.
+// Returns 0 if there is none.
+static uint
+vmaplace(struct proc *p, uint len)
+{
+  struct vma *v;
+  uint heap, end;
+
+  heap = PGROUNDUP(p->vmowner->sz);
+  end = KERNBASE;
+again:
+  if(end < heap || end - heap < len)
+    return 0;
+  for(v = p->vmowner->vma; v < &p->vmowner->vma[NVMA]; v++){
+    if(v->end && v->start < end && v->end > end - len){
+      end = PGROUNDDOWN(v->start);
+      goto again;
+    }
+  }
+  return end - len;
+}
+
+// Map len bytes of ip starting at file offset off, or zeroed
+// memory if ip is 0, into the current process. The region goes
+// at addr if that is free and page aligned, else wherever there
+// is room. Nothing is read until pgfault(). Returns the address
+// of the region, or -1.
+int
+mmap(uint addr, uint len, int prot, int flags, struct inode *ip, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+
+  if(len == 0 || len > KERNBASE || off % PGSIZE ||
+     !(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
+    return -1;
+  len = PGROUNDUP(len);
+  growlock(p);
+  if(addr % PGSIZE || addr < PGROUNDUP(p->vmowner->sz) ||
+     addr + len < addr || addr + len > KERNBASE ||
+     !vmafree(p, addr, addr + len))
+    addr = vmaplace(p, len);
+  nv = 0;
+  for(v = p->vmowner->vma; v < &p->vmowner->vma[NVMA]; v++)
+    if(v->end == 0)
+      nv = v;
+  if(addr == 0 || nv == 0){
+    growunlock(p);
+    return -1;
+  }
+  nv->filesz = 0;
+  if(ip){
+    ilock(ip);
+    if(ip->type != T_FILE){
+      iunlock(ip);
+      growunlock(p);
+      return -1;
+    }
+    if(off < ip->size)
+      nv->filesz = ip->size - off < len ? ip->size - off : len;
+    iunlock(ip);
+    idup(ip);
+  }
+  nv->start = addr;
+  nv->end = addr + len;
+  nv->off = off;
+  nv->writable = (prot & PROT_WRITE) != 0;
+  nv->shared = (flags & MAP_SHARED) != 0;
+  nv->ip = ip;
+  growunlock(p);
+  return addr;
+}
+
+// Write the dirty pages of shared file region v in [start, end)
+// back to the file. Returns -1 if a write fails.
+static int
+vmasync(pde_t *pgdir, struct vma *v, uint start, uint end)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;  // as in filewrite()
+  uint a, pgoff, n, i, n1;
+  char *page;
+  pte_t *pte;
+  int r;
+
+  for(a = start; a < end; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(pte == 0 || !(*pte & PTE_P) || !(*pte & PTE_D))
+      continue;
+    pgoff = a - v->start;
+    if(pgoff >= v->filesz)
+      continue;  // past the end of the file
+    n = v->filesz - pgoff < PGSIZE ? v->filesz - pgoff : PGSIZE;
+    page = P2V(PTE_ADDR(*pte));
+    // Clean before writing, so that stores made meanwhile
+    // leave it dirty again.
+    *pte &= ~PTE_D;
+    flushpages(pgdir, a, PGSIZE);
+    for(i = 0; i < n; i += n1){
+      n1 = n - i < max ? n - i : max;
+      begin_op();
+      ilock(v->ip);
+      r = writei(v->ip, page + i, v->off + pgoff + i, n1);
+      iunlock(v->ip);
+      end_op();
+      if(r != n1)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Write back the dirty pages of all of p's shared file mappings,
+// before exit(), exec() or restore() drop them with vmaput().
+// vmasync() starts transactions, so the caller must not be in one.
+void
+vmasyncall(struct proc *p)
+{
+  struct vma *v;
+
+  growlock(p);
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end && v->shared && v->ip)
+      vmasync(p->pgdir, v, v->start, v->end);
+  growunlock(p);
+}
+
+// Write back the dirty pages of the current process's shared
+// file mappings in [addr, addr+len).
+int
+msync(uint addr, uint len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint end;
+  int r;
+
+  end = PGROUNDUP(addr + len);
+  if(addr % PGSIZE || end < addr || end > KERNBASE)
+    return -1;
+  r = 0;
+  growlock(p);
+  for(v = p->vmowner->vma; v < &p->vmowner->vma[NVMA]; v++){
+    if(v->end == 0 || !v->shared || v->ip == 0 ||
+       v->start >= end || v->end <= addr)
+      continue;
+    if(vmasync(p->pgdir, v, addr > v->start ? addr : v->start,
+               end < v->end ? end : v->end) < 0)
+      r = -1;
+  }
+  growunlock(p);
+  return r;
+}
+
+// Remove the mappings of [addr, addr+len) from the current
+// process, writing shared file pages back first. Regions are
+// trimmed, or split if the range is in the middle of one.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint end, s, e;
+
+  end = PGROUNDUP(addr + len);
+  if(addr % PGSIZE || len == 0 || end < addr || end > KERNBASE)
+    return -1;
+  growlock(p);
+  for(v = p->vmowner->vma; v < &p->vmowner->vma[NVMA]; v++){
+    if(v->end == 0 || v->start >= end || v->end <= addr)
+      continue;
+    if(v->shm){
+      // Segments are detached whole, with shmdt().
+      growunlock(p);
+      return -1;
+    }
+    s = addr > v->start ? addr : v->start;
+    e = end < PGROUNDUP(v->end) ? end : PGROUNDUP(v->end);
+    if(s > v->start && e < v->end){
+      // Split: the part above the hole needs a slot of its own.
+      for(nv = p->vmowner->vma; nv < &p->vmowner->vma[NVMA]; nv++)
+        if(nv->end == 0)
+          break;
+      if(nv == &p->vmowner->vma[NVMA]){
+        growunlock(p);
+        return -1;
+      }
+      *nv = *v;
+      nv->start = e;
+      nv->off += e - v->start;
+      nv->filesz = v->filesz > e - v->start ? v->filesz - (e - v->start) : 0;
+      if(nv->ip)
+        idup(nv->ip);
+    }
+    if(v->shared && v->ip)
+      vmasync(p->pgdir, v, s, e);
+    deallocuvm(p->pgdir, e, s);
+    if(s == v->start && e >= v->end){
+      if(v->ip){
+        begin_op();
+        iput(v->ip);
+        end_op();
+      }
+      memset(v, 0, sizeof(*v));
+    } else if(s == v->start){
+      v->filesz = v->filesz > e - v->start ? v->filesz - (e - v->start) : 0;
+      v->off += e - v->start;
+      v->start = e;
+    } else {
+      if(v->filesz > s - v->start)
+        v->filesz = s - v->start;
+      v->end = s;
+    }
+  }
+  growunlock(p);
+  return 0;
+}
+
+// Attach the shared memory segment called name, creating it
+// with size bytes if it does not exist, to the current process.
+// Its pages are mapped right away. Returns the address of the
+// segment, or -1.
+int
+shmat(char *name, uint size)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  struct shm *s;
+  uint addr, i, len;
+  char *pg;
+
+  if((s = shmget(name, size)) == 0)
+    return -1;
+  len = shmsize(s) * PGSIZE;
+  growlock(p);
+  nv = 0;
+  for(v = p->vmowner->vma; v < &p->vmowner->vma[NVMA]; v++)
+    if(v->end == 0)
+      nv = v;
+  if(nv == 0 || (addr = vmaplace(p, len)) == 0)
+    goto bad;
+  for(i = 0; i < shmsize(s); i++){
+    pg = shmpage(s, i);
+    if(mappages(p->pgdir, (char*)addr + i*PGSIZE, PGSIZE, V2P(pg),
+                PTE_W|PTE_U|PTE_SHARED) < 0){
+      deallocuvm(p->pgdir, addr + i*PGSIZE, addr);
       goto bad;
     }
+    kref(pg);
   }
-  return d;
+  memset(nv, 0, sizeof(*nv));
+  nv->start = addr;
+  nv->end = addr + len;
+  nv->writable = 1;
+  nv->shared = 1;
+  nv->shm = s;
+  growunlock(p);
+  return addr;
 
 bad:
-  freevm(d);
+  growunlock(p);
+  shmput(s);
+  return -1;
+}
+
+// Detach the segment attached at addr from the current process.
+int
+shmdt(uint addr)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  struct shm *s;
+
+  growlock(p);
+  for(v = p->vmowner->vma; v < &p->vmowner->vma[NVMA]; v++)
+    if(v->end && v->shm && v->start == addr)
+      break;
+  if(v == &p->vmowner->vma[NVMA]){
+    growunlock(p);
+    return -1;
+  }
+  deallocuvm(p->pgdir, v->end, v->start);
+  s = v->shm;
+  memset(v, 0, sizeof(*v));
+  growunlock(p);
+  shmput(s);
   return 0;
 }
 
@@ -356,6 +1354,8 @@ uva2ka(pde_t *pgdir, char *uva)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
+  if(*pte & PTE_PS)
+    return (char*)P2V(PTE_ADDR(*pte)) + PGROUNDDOWN((uint)uva % SPGSIZE);
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
@@ -367,10 +1367,14 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowcopy(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
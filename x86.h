@@ -130,6 +130,17 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically add incr to *addr and return the old value.
+static inline ushort
+xaddw(volatile ushort *addr, ushort incr)
+{
+  asm volatile("lock; xaddw %0, %1" :
+               "+r" (incr), "+m" (*addr) :
+               :
+               "cc", "memory");
+  return incr;
+}
+
 static inline uint
 rcr2(void)
 {
@@ -144,6 +155,58 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr0(void)
+{
+  uint val;
+  asm volatile("movl %%cr0,%0" : "=r" (val));
+  return val;
+}
+
+static inline void
+lcr0(uint val)
+{
+  asm volatile("movl %0,%%cr0" : : "r" (val));
+}
+
+static inline uint
+rcr4(void)
+{
+  uint val;
+  asm volatile("movl %%cr4,%0" : "=r" (val));
+  return val;
+}
+
+static inline void
+lcr4(uint val)
+{
+  asm volatile("movl %0,%%cr4" : : "r" (val));
+}
+
+static inline void
+clts(void)
+{
+  asm volatile("clts");
+}
+
+static inline void
+fxsave(void *addr)
+{
+  asm volatile("fxsave (%0)" : : "r" (addr) : "memory");
+}
+
+static inline void
+fxrstor(void *addr)
+{
+  asm volatile("fxrstor (%0)" : : "r" (addr) : "memory");
+}
+
+static inline void
+invlpg(void *addr)
+{
+  asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().